@@ -0,0 +1,9 @@
+TARGET = ohmdbench
+
+CONFIG += console
+CONFIG -= app_bundle
+
+include(../common.pri)
+
+SOURCES += \
+    main.cpp
@@ -0,0 +1,360 @@
+#include "mirrorblit.h"
+#include "ohmdhandler.h"
+#include "steadyclock.h"
+#include "videorenderer.h"
+#include "vrrenderer.h"
+
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QThread>
+#include <QDebug>
+#include <algorithm>
+#include <clocale>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Plays a file through the same video thread and compositor as the player,
+// but into an offscreen FBO as fast as it can, and prints how long the frames
+// took for each projection mode and video angle.
+
+static double percentileMs(const std::vector<qint64> &sorted, double percentile)
+{
+    if (sorted.empty()) {
+        return 0.;
+    }
+    const size_t index = std::min(sorted.size() - 1, size_t(percentile * sorted.size()));
+    return sorted[index] / 1e6;
+}
+
+static void drainMpvEvents(mpv_handle *mpv)
+{
+    while (mpv_wait_event(mpv, 0)->event_id != MPV_EVENT_NONE) {
+    }
+}
+
+static QSize waitForVideoSize(mpv_handle *mpv)
+{
+    const qint64 timeout = SteadyClock::nowNs() + 10000000000;
+    while (SteadyClock::nowNs() < timeout) {
+        mpv_event *event = mpv_wait_event(mpv, 0.1);
+        if (event->event_id == MPV_EVENT_END_FILE) {
+            break;
+        }
+
+        int64_t width = 0, height = 0;
+        if (mpv_get_property(mpv, "width", MPV_FORMAT_INT64, &width) >= 0 &&
+                mpv_get_property(mpv, "height", MPV_FORMAT_INT64, &height) >= 0 &&
+                width > 0 && height > 0) {
+            return QSize(width, height);
+        }
+    }
+    return QSize();
+}
+
+int main(int argc, char *argv[])
+{
+    const QString sizeArg = "--size";
+    const QString framesArg = "--frames";
+    const QString warmupArg = "--warmup";
+    const QString realtimeArg = "--realtime";
+    const QString viewportCropArg = "--viewport-crop";
+    const QString noLensCorrection = "--no-lens-correction";
+    const QString fusedEyesArg = "--fused-eyes";
+    const QString replayArg = "--replay";
+    const QString videoScaleArg = "--video-scale";
+    const QString noMipmaps = "--no-mipmaps";
+    const QString noTiling = "--no-tiling";
+    const QString projectionArg = "--projection";
+    const QString mirrorRateArg = "--mirror-rate";
+    const QString mirrorDistortedArg = "--mirror-distorted";
+    const char *path = nullptr;
+    QSize hmdSize;
+    int frames = 600;
+    int warmup = 60;
+    bool realtime = false;
+    bool viewportCrop = false;
+    bool lensCorrection = true;
+    bool fusedEyes = false;
+    QString replayPath;
+    float videoScale = 1;
+    bool mipmaps = true;
+    bool tiledVideo = true;
+    VrRenderer::ProjectionFormat projectionFormat = VrRenderer::Equirectangular;
+    float mirrorRate = 0;
+    bool mirrorDistorted = false;
+    for (int i=1; i<argc; i++) {
+        if (argv[i] == sizeArg && i + 1 < argc) {
+            const QStringList size = QString(argv[++i]).split('x');
+            if (size.count() == 2) {
+                hmdSize = QSize(size[0].toInt(), size[1].toInt());
+            }
+            if (hmdSize.isEmpty()) {
+                qWarning() << "Invalid size" << argv[i];
+                return 1;
+            }
+            continue;
+        }
+        if (argv[i] == framesArg && i + 1 < argc) {
+            frames = qMax(1, QString(argv[++i]).toInt());
+            continue;
+        }
+        if (argv[i] == warmupArg && i + 1 < argc) {
+            warmup = qMax(0, QString(argv[++i]).toInt());
+            continue;
+        }
+        if (argv[i] == realtimeArg) {
+            realtime = true;
+            continue;
+        }
+        if (argv[i] == viewportCropArg) {
+            viewportCrop = true;
+            continue;
+        }
+        if (argv[i] == noMipmaps) {
+            mipmaps = false;
+            continue;
+        }
+        if (argv[i] == noTiling) {
+            tiledVideo = false;
+            continue;
+        }
+        if (argv[i] == projectionArg && i + 1 < argc) {
+            const QString format = argv[++i];
+            if (format == "equirect") {
+                projectionFormat = VrRenderer::Equirectangular;
+            } else if (format == "eac") {
+                projectionFormat = VrRenderer::EquiAngularCubemap;
+            } else if (format == "cubemap") {
+                projectionFormat = VrRenderer::Cubemap;
+            } else {
+                qWarning() << "Unknown projection" << format << "expected equirect, eac or cubemap";
+                return 1;
+            }
+            continue;
+        }
+        if (argv[i] == videoScaleArg && i + 1 < argc) {
+            videoScale = QString(argv[++i]).toFloat();
+            continue;
+        }
+        if (argv[i] == replayArg && i + 1 < argc) {
+            replayPath = QString::fromLocal8Bit(argv[++i]);
+            continue;
+        }
+        if (argv[i] == noLensCorrection) {
+            lensCorrection = false;
+            continue;
+        }
+        if (argv[i] == fusedEyesArg) {
+            fusedEyes = true;
+            continue;
+        }
+        if (argv[i] == mirrorRateArg && i + 1 < argc) {
+            mirrorRate = qMax(0.f, QString(argv[++i]).toFloat());
+            continue;
+        }
+        if (argv[i] == mirrorDistortedArg) {
+            mirrorDistorted = true;
+            continue;
+        }
+        if (path != nullptr) {
+            path = nullptr;
+            break;
+        }
+        path = argv[i];
+    }
+    if (!path) {
+        // Also ends up here if there were two paths
+        qWarning() << "Usage:" << argv[0] << "[--size WxH] [--frames n] [--warmup n] [--realtime] [--viewport-crop] [--no-lens-correction] [--fused-eyes] [--replay posetrace] [--video-scale s] [--no-mipmaps] [--no-tiling] [--projection equirect|eac|cubemap] [--mirror-rate hz [--mirror-distorted]] videofile";
+        return 1;
+    }
+
+    QSurfaceFormat format;
+    format.setMajorVersion(3);
+    format.setMinorVersion(3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    QSurfaceFormat::setDefaultFormat(format);
+
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+    QGuiApplication app(argc, argv);
+
+    setlocale(LC_NUMERIC, "C");
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) {
+        qWarning() << "could not create mpv context";
+        return 1;
+    }
+    mpv_set_option_string(mpv, "terminal", "yes");
+    mpv_set_option_string(mpv, "msg-level", "all=warn");
+    mpv_set_option_string(mpv, "audio", "no");
+    mpv_set_option_string(mpv, "loop-file", "inf");
+    if (!realtime) {
+        // Don't wait for the video clock, decode and render as fast as we can
+        mpv_set_option_string(mpv, "untimed", "yes");
+    }
+    if (viewportCrop || tiledVideo) {
+        mpv_set_option_string(mpv, "keepaspect", "no");
+    }
+    if (mpv_initialize(mpv) < 0) {
+        qWarning() << "could not initialize mpv context";
+        return 1;
+    }
+
+    // The dummy driver gives us a reproducible headset (and the same lens
+    // distortion every time) on any machine.
+    OhmdHandler ohmd(nullptr, "Dummy Device");
+    if (!ohmd.waitForInit()) {
+        qWarning() << "OpenHMD dummy device not available, running without a headset pose";
+    }
+    if (!replayPath.isEmpty()) {
+        // One 90 Hz frame of recorded motion per rendered frame, no matter
+        // how fast we render
+        if (!ohmd.startReplay(replayPath, OhmdHandler::ReplayFast, 1000000000 / 90)) {
+            return 1;
+        }
+    }
+    if (hmdSize.isEmpty()) {
+        hmdSize = ohmd.displaySize.isEmpty() ? QSize(1920, 1080) : ohmd.displaySize;
+    }
+
+    QOffscreenSurface surface;
+    surface.setFormat(QSurfaceFormat::defaultFormat());
+    surface.create();
+
+    QOpenGLContext context;
+    context.setFormat(QSurfaceFormat::defaultFormat());
+    context.setShareContext(QOpenGLContext::globalShareContext());
+    if (!context.create() || !context.makeCurrent(&surface)) {
+        qWarning() << "Failed to create GL context";
+        return 1;
+    }
+    QOpenGLFunctions *gl = context.functions();
+    qDebug() << "GL renderer" << reinterpret_cast<const char*>(gl->glGetString(GL_RENDERER));
+
+    VideoRenderer videoRenderer(mpv, nullptr);
+    VrRenderer renderer(&ohmd, &videoRenderer);
+    renderer.logStats = false;
+    renderer.predictionMs = 0;
+    renderer.viewportCrop = viewportCrop;
+    renderer.lensCorrection = lensCorrection;
+    renderer.fusedEyes = fusedEyes;
+    renderer.videoScale = videoScale;
+    renderer.mipmaps = mipmaps;
+    renderer.tiledVideo = tiledVideo;
+    renderer.projectionFormat = projectionFormat;
+    renderer.mirrorRate = mirrorRate;
+    renderer.mirrorDistorted = mirrorDistorted;
+    renderer.initializeGL();
+
+    QOpenGLFramebufferObject target(hmdSize);
+
+    // Stands in for the mirror window, in the same context since the blit
+    // doesn't care
+    QOpenGLFramebufferObject mirrorTarget(QSize(960, 540));
+    MirrorBlit mirror;
+    mirror.initializeGL();
+
+    videoRenderer.setVideoSize(hmdSize);
+    videoRenderer.startRendering();
+    while (!videoRenderer.isReady() && videoRenderer.isRunning()) {
+        QThread::msleep(1);
+    }
+    if (!videoRenderer.isReady()) {
+        qWarning() << "Failed to start video renderer";
+        return 1;
+    }
+
+    const char *args[] = {"loadfile", path, NULL};
+    mpv_command(mpv, args);
+    const QSize sourceSize = waitForVideoSize(mpv);
+    if (sourceSize.isEmpty()) {
+        qWarning() << "Failed to load" << path;
+        return 1;
+    }
+
+    printf("# %s, hmd %dx%d, video %dx%d, %d frames\n", path, hmdSize.width(), hmdSize.height(),
+           sourceSize.width(), sourceSize.height(), frames);
+    if (mirrorRate > 0) {
+        printf("# mirroring %s at %.0f Hz into %dx%d\n", mirrorDistorted ? "the display" : "the eye buffer", mirrorRate,
+               mirrorTarget.width(), mirrorTarget.height());
+    }
+    printf("%-12s %5s %11s %8s %8s %8s %9s %10s\n", "mode", "angle", "texture", "fps", "p50_ms", "p99_ms", "video_fps", "mirror_fps");
+
+    const struct {
+        VrRenderer::VideoProjectionMode mode;
+        const char *name;
+    } modes[] = {
+        { VrRenderer::Monoscopic, "mono" },
+        { VrRenderer::OverUnder, "over-under" },
+        { VrRenderer::SideBySide, "side-by-side" },
+    };
+    const float angles[] = { 180.f, 360.f };
+
+    std::vector<qint64> frameTimes;
+    frameTimes.reserve(frames);
+    for (const auto &mode : modes) {
+        for (const float angle : angles) {
+            // The cube formats are always 360
+            if (projectionFormat != VrRenderer::Equirectangular && angle < 360.f) {
+                continue;
+            }
+            renderer.video_projection_mode = mode.mode;
+            renderer.videoAngle = angle;
+            const QSize videoSize = renderer.videoTextureSize(sourceSize, hmdSize);
+            videoRenderer.setVideoSize(videoSize);
+
+            frameTimes.clear();
+            VrRenderer::FrameCounters startCounters;
+            qint64 startTime = 0;
+            int mirrorFrames = 0;
+            for (int frame = 0; frame < warmup + frames; frame++) {
+                if (frame == warmup) {
+                    startCounters = renderer.frameCounters();
+                    startTime = SteadyClock::nowNs();
+                }
+
+                // Without a trace turn around once every few seconds, so the
+                // crop and the visible part of the sphere keep changing
+                if (replayPath.isEmpty()) {
+                    renderer.rotHor = std::fmod(frame * 0.5f, 360.f);
+                }
+
+                const qint64 frameStart = SteadyClock::nowNs();
+                renderer.render(target.handle(), hmdSize, 0);
+                // Only when there is something new, like the window
+                if (renderer.hasMirrorFrame()) {
+                    mirror.present(&renderer, mirrorTarget.handle(), mirrorTarget.size());
+                    if (frame >= warmup) {
+                        mirrorFrames++;
+                    }
+                }
+                gl->glFinish();
+                if (frame >= warmup) {
+                    frameTimes.push_back(SteadyClock::nowNs() - frameStart);
+                }
+
+                drainMpvEvents(mpv);
+            }
+            const double seconds = (SteadyClock::nowNs() - startTime) / 1e9;
+            const quint64 videoFrames = renderer.frameCounters().fresh - startCounters.fresh;
+
+            std::sort(frameTimes.begin(), frameTimes.end());
+            const QByteArray texture = QByteArray::number(videoSize.width()) + 'x' + QByteArray::number(videoSize.height());
+            printf("%-12s %5.0f %11s %8.1f %8.2f %8.2f %9.1f %10.1f\n", mode.name, angle, texture.constData(),
+                   frames / seconds, percentileMs(frameTimes, 0.5), percentileMs(frameTimes, 0.99),
+                   videoFrames / seconds, mirrorFrames / seconds);
+            fflush(stdout);
+        }
+    }
+
+    mirror.releaseGL();
+    renderer.releaseGL();
+    context.doneCurrent();
+
+    videoRenderer.stopRendering();
+    mpv_terminate_destroy(mpv);
+
+    return 0;
+}
@@ -0,0 +1,48 @@
+# Everything but the window, shared by the player and the benchmark
+
+QT += core gui
+INCLUDEPATH += /usr/include/openhmd $$PWD
+
+CONFIG += c++11
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+LIBS += -lopenhmd -lmpv
+
+SOURCES += \
+    $$PWD/distortionmesh.cpp \
+    $$PWD/frameprofiler.cpp \
+    $$PWD/mirrorblit.cpp \
+    $$PWD/ohmdhandler.cpp \
+    $$PWD/overlay.cpp \
+    $$PWD/posepredictor.cpp \
+    $$PWD/posetrace.cpp \
+    $$PWD/resolutionscaler.cpp \
+    $$PWD/shadercache.cpp \
+    $$PWD/spheremesh.cpp \
+    $$PWD/videorenderer.cpp \
+    $$PWD/viewportcrop.cpp \
+    $$PWD/vrrenderer.cpp
+
+HEADERS += \
+    $$PWD/distortionmesh.h \
+    $$PWD/frameprofiler.h \
+    $$PWD/mirrorblit.h \
+    $$PWD/ohmdhandler.h \
+    $$PWD/overlay.h \
+    $$PWD/rendermetrics.h \
+    $$PWD/posepredictor.h \
+    $$PWD/posetrace.h \
+    $$PWD/resolutionscaler.h \
+    $$PWD/shadercache.h \
+    $$PWD/spheremesh.h \
+    $$PWD/spscring.h \
+    $$PWD/startuplog.h \
+    $$PWD/steadyclock.h \
+    $$PWD/triplebuffer.h \
+    $$PWD/videorenderer.h \
+    $$PWD/viewportcrop.h \
+    $$PWD/vrrenderer.h
+
+RESOURCES += \
+    $$PWD/shaders.qrc
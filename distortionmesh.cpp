@@ -0,0 +1,106 @@
+#include "distortionmesh.h"
+
+#include <QtMath>
+#include <cstring>
+
+bool DistortionParams::operator==(const DistortionParams &other) const
+{
+    return memcmp(this, &other, sizeof(DistortionParams)) == 0;
+}
+
+// Same as the universal distortion shader OpenHMD ships, just run once per
+// vertex instead of once per pixel.
+static void distort(const DistortionParams &params, const float lensCenter[2], float x, float y, DistortionVertex *vertex)
+{
+    // Lens centered coordinates, in the units the distortion model wants
+    float rx = (x * params.viewportScale[0] - lensCenter[0]) / params.warpScale;
+    float ry = (y * params.viewportScale[1] - lensCenter[1]) / params.warpScale;
+
+    const float r = std::sqrt(rx * rx + ry * ry);
+    const float scale = params.coefficients[3] +
+            params.coefficients[2] * r +
+            params.coefficients[1] * r * r +
+            params.coefficients[0] * r * r * r;
+
+    rx *= scale * params.warpScale;
+    ry *= scale * params.warpScale;
+
+    float *uvs[3] = { vertex->uvRed, vertex->uvGreen, vertex->uvBlue };
+    for (int channel = 0; channel < 3; channel++) {
+        uvs[channel][0] = (lensCenter[0] + params.aberration[channel] * rx) / params.viewportScale[0];
+        uvs[channel][1] = (lensCenter[1] + params.aberration[channel] * ry) / params.viewportScale[1];
+    }
+}
+
+void DistortionMesh::generate(const DistortionParams &params, int resolution)
+{
+    vertices.clear();
+    indices.clear();
+
+    const int rowLength = resolution + 1;
+    vertices.reserve(2 * rowLength * rowLength);
+    indices.reserve(2 * resolution * resolution * 6);
+
+    for (int eye = 0; eye < 2; eye++) {
+        const float *lensCenter = eye == 0 ? params.leftLensCenter : params.rightLensCenter;
+        const quint16 firstVertex = vertices.size();
+
+        for (int row = 0; row <= resolution; row++) {
+            const float y = float(row) / resolution;
+
+            for (int column = 0; column <= resolution; column++) {
+                const float x = float(column) / resolution;
+
+                DistortionVertex vertex;
+                vertex.position[0] = (eye + x) - 1.f;
+                vertex.position[1] = y * 2.f - 1.f;
+                vertex.eyeOffset = eye * 0.5f;
+                distort(params, lensCenter, x, y, &vertex);
+                vertices.append(vertex);
+            }
+        }
+
+        for (int row = 0; row < resolution; row++) {
+            for (int column = 0; column < resolution; column++) {
+                const quint16 bottomLeft = firstVertex + row * rowLength + column;
+                const quint16 bottomRight = bottomLeft + 1;
+                const quint16 topLeft = bottomLeft + rowLength;
+                const quint16 topRight = topLeft + 1;
+                indices << bottomLeft << bottomRight << topLeft;
+                indices << topLeft << bottomRight << topRight;
+            }
+        }
+    }
+}
+
+void DistortionLookup::generate(const DistortionParams &params, const QSize &lookupSize, const float tanHalfFov[2])
+{
+    size = lookupSize;
+    texels.resize(size.width() * size.height() * 2);
+
+    const int eyeWidth = size.width() / 2;
+    for (int eye = 0; eye < 2; eye++) {
+        const float *center = eye == 0 ? params.leftLensCenter : params.rightLensCenter;
+        for (int axis = 0; axis < 2; axis++) {
+            lensCenter[eye][axis] = (center[axis] / params.viewportScale[axis] * 2.f - 1.f) * tanHalfFov[axis];
+        }
+
+        for (int row = 0; row < size.height(); row++) {
+            const float y = (row + 0.5f) / size.height();
+            float *texel = texels.data() + (row * size.width() + eye * eyeWidth) * 2;
+
+            for (int column = 0; column < eyeWidth; column++) {
+                const float x = (column + 0.5f) / eyeWidth;
+
+                DistortionVertex vertex;
+                distort(params, center, x, y, &vertex);
+                *texel++ = (vertex.uvGreen[0] * 2.f - 1.f) * tanHalfFov[0];
+                *texel++ = (vertex.uvGreen[1] * 2.f - 1.f) * tanHalfFov[1];
+            }
+        }
+    }
+
+    const float green = params.aberration[1] != 0.f ? params.aberration[1] : 1.f;
+    aberration[0] = params.aberration[0] / green;
+    aberration[1] = params.aberration[2] / green;
+}
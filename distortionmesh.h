@@ -0,0 +1,68 @@
+#ifndef DISTORTIONMESH_H
+#define DISTORTIONMESH_H
+
+#include <QSize>
+#include <QVector>
+
+// Lens parameters as reported by OpenHMD, see OhmdHandler::init()
+struct DistortionParams
+{
+    float viewportScale[2]{};
+    float leftLensCenter[2]{};
+    float rightLensCenter[2]{};
+    float warpScale = 0;
+    float coefficients[4]{};
+    float aberration[3]{};
+
+    bool isValid() const { return viewportScale[0] > 0 && viewportScale[1] > 0 && warpScale > 0; }
+    bool operator==(const DistortionParams &other) const;
+    bool operator!=(const DistortionParams &other) const { return !(*this == other); }
+};
+
+struct DistortionVertex
+{
+    // Clip space position on the display
+    float position[2];
+
+    // Where to sample each color channel from, relative to the eye, [0, 1]
+    float uvRed[2];
+    float uvGreen[2];
+    float uvBlue[2];
+
+    // Horizontal offset of the eye in the side by side eye buffer
+    float eyeOffset;
+};
+
+// Low resolution grid over both eyes that has the lens distortion and
+// chromatic aberration correction baked into its texture coordinates, so the
+// warp pass is just a (slightly fancy) textured blit.
+class DistortionMesh
+{
+public:
+    void generate(const DistortionParams &params, int resolution = 40);
+
+    QVector<DistortionVertex> vertices;
+    QVector<quint16> indices;
+};
+
+// Per pixel version of the mesh for the fused eye pass: for every pixel of
+// both eyes (side by side) where the green channel ends up on the eye's
+// image plane at z = -1. tanHalfFov are the edges of that plane, i.e. what
+// the eye buffer would have covered.
+class DistortionLookup
+{
+public:
+    void generate(const DistortionParams &params, const QSize &size, const float tanHalfFov[2]);
+
+    QSize size;
+
+    // Two floats per texel, bottom row first
+    QVector<float> texels;
+
+    // Where the lens centres are on the image plane, and how much further
+    // out than green red and blue end up, the aberration scales around them.
+    float lensCenter[2][2]{};
+    float aberration[2]{};
+};
+
+#endif // DISTORTIONMESH_H
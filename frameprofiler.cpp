@@ -0,0 +1,232 @@
+#include "frameprofiler.h"
+
+#include "steadyclock.h"
+
+#include <QOpenGLContext>
+#include <QDebug>
+#include <algorithm>
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF
+#endif
+
+const char *Timing::sectionName(int section)
+{
+    switch (section) {
+    case MpvRender:
+        return "mpv render";
+    case Mipmaps:
+        return "mipmaps";
+    case PoseUpdate:
+        return "pose update";
+    case Eyes:
+        return "eyes";
+    case Distortion:
+        return "distortion";
+    case Swap:
+        return "swap";
+    default:
+        return "unknown";
+    }
+}
+
+void TimingRecorder::initializeGL()
+{
+    initializeOpenGLFunctions();
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_timerQueries = !context->isOpenGLES() &&
+            (context->format().version() >= qMakePair(3, 3) || context->hasExtension("GL_ARB_timer_query"));
+    if (m_timerQueries) {
+        glGenQueries(QueryCount, m_queries);
+    } else {
+        qWarning() << m_name << "no timer queries, only measuring CPU time";
+    }
+    m_pendingHead = 0;
+    m_pendingCount = 0;
+}
+
+void TimingRecorder::releaseGL()
+{
+    if (m_timerQueries) {
+        glDeleteQueries(QueryCount, m_queries);
+        m_timerQueries = false;
+    }
+    m_pendingCount = 0;
+}
+
+void TimingRecorder::begin(int section, bool gpu)
+{
+    Pending &open = m_open[section];
+    open.sample = Timing::Sample();
+    open.sample.frame = m_frame;
+    open.sample.section = section;
+    open.query = 0;
+
+    if (gpu && m_timerQueries && m_pendingCount < QueryCount) {
+        open.query = m_queries[(m_pendingHead + m_pendingCount) % QueryCount];
+        glBeginQuery(GL_TIME_ELAPSED, open.query);
+    }
+    open.sample.timestamp = SteadyClock::nowNs();
+}
+
+void TimingRecorder::end(int section)
+{
+    Pending &open = m_open[section];
+    open.sample.cpuNs = SteadyClock::nowNs() - open.sample.timestamp;
+
+    if (!open.query) {
+        push(open.sample);
+        return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pending[(m_pendingHead + m_pendingCount) % QueryCount] = open;
+    m_pendingCount++;
+    open.query = 0;
+}
+
+void TimingRecorder::collect()
+{
+    // Queries finish in the order they were issued
+    while (m_pendingCount > 0) {
+        Pending &pending = m_pending[m_pendingHead];
+        GLuint available = 0;
+        glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+
+        // Nanoseconds, so 32 bits is plenty for anything we measure
+        GLuint elapsed = 0;
+        glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT, &elapsed);
+        pending.sample.gpuNs = elapsed;
+        push(pending.sample);
+
+        m_pendingHead = (m_pendingHead + 1) % QueryCount;
+        m_pendingCount--;
+    }
+}
+
+void TimingRecorder::push(const Timing::Sample &sample)
+{
+    if (!m_samples.push(sample)) {
+        m_dropped++;
+    }
+}
+
+FrameProfiler::FrameProfiler() :
+    m_startTime(SteadyClock::nowNs()),
+    m_windowStart(m_startTime)
+{
+}
+
+FrameProfiler::~FrameProfiler()
+{
+    flushCsv();
+}
+
+TimingRecorder *FrameProfiler::addRecorder(const QByteArray &name)
+{
+    m_recorders.emplace_back(new TimingRecorder(name));
+    m_accumulators.resize(m_recorders.size() * Timing::SectionCount);
+    return m_recorders.back().get();
+}
+
+bool FrameProfiler::openCsv(const QString &path)
+{
+    m_csv.setFileName(path);
+    if (!m_csv.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open" << path << m_csv.errorString();
+        return false;
+    }
+    m_csv.write("timestamp_ms,thread,frame,section,cpu_ms,gpu_ms\n");
+    return true;
+}
+
+bool FrameProfiler::consume()
+{
+    for (size_t recorderIndex = 0; recorderIndex < m_recorders.size(); recorderIndex++) {
+        TimingRecorder *recorder = m_recorders[recorderIndex].get();
+
+        Timing::Sample sample;
+        while (recorder->takeSample(sample)) {
+            Accumulator &accumulator = m_accumulators[recorderIndex * Timing::SectionCount + sample.section];
+            accumulator.count++;
+            accumulator.cpuNs += sample.cpuNs;
+            accumulator.cpuMaxNs = qMax(accumulator.cpuMaxNs, sample.cpuNs);
+            if (sample.gpuNs >= 0) {
+                accumulator.gpuCount++;
+                accumulator.gpuNs += sample.gpuNs;
+                accumulator.gpuMaxNs = qMax(accumulator.gpuMaxNs, sample.gpuNs);
+                m_gpuNs += sample.gpuNs;
+            }
+
+            if (!m_csv.isOpen()) {
+                continue;
+            }
+            m_csvBuffer += QByteArray::number((sample.timestamp - m_startTime) / 1e6, 'f', 3);
+            m_csvBuffer += ',' + recorder->name();
+            m_csvBuffer += ',' + QByteArray::number(sample.frame);
+            m_csvBuffer += ',' + QByteArray(Timing::sectionName(sample.section));
+            m_csvBuffer += ',' + QByteArray::number(sample.cpuNs / 1e6, 'f', 3);
+            m_csvBuffer += ',';
+            if (sample.gpuNs >= 0) {
+                m_csvBuffer += QByteArray::number(sample.gpuNs / 1e6, 'f', 3);
+            }
+            m_csvBuffer += '\n';
+        }
+    }
+
+    const qint64 now = SteadyClock::nowNs();
+    if (now - m_windowStart < 1000000000) {
+        return false;
+    }
+
+    updateSummary();
+    flushCsv();
+
+    std::fill(m_accumulators.begin(), m_accumulators.end(), Accumulator());
+    m_windowStart = now;
+    return true;
+}
+
+void FrameProfiler::updateSummary()
+{
+    m_summary.clear();
+    for (size_t recorderIndex = 0; recorderIndex < m_recorders.size(); recorderIndex++) {
+        const TimingRecorder *recorder = m_recorders[recorderIndex].get();
+        for (int section = 0; section < Timing::SectionCount; section++) {
+            const Accumulator &accumulator = m_accumulators[recorderIndex * Timing::SectionCount + section];
+            if (accumulator.count == 0) {
+                continue;
+            }
+
+            QString line = QString("%1 %2/s cpu %3 ms (max %4)")
+                    .arg(Timing::sectionName(section), -12)
+                    .arg(accumulator.count, 3)
+                    .arg(accumulator.cpuNs / 1e6 / accumulator.count, 0, 'f', 2)
+                    .arg(accumulator.cpuMaxNs / 1e6, 0, 'f', 2);
+            if (accumulator.gpuCount > 0) {
+                line += QString(" gpu %1 ms (max %2)")
+                        .arg(accumulator.gpuNs / 1e6 / accumulator.gpuCount, 0, 'f', 2)
+                        .arg(accumulator.gpuMaxNs / 1e6, 0, 'f', 2);
+            }
+            m_summary.append(line);
+        }
+
+        if (recorder->droppedSamples() > 0) {
+            m_summary.append(QString("%1 dropped %2 samples").arg(QString(recorder->name())).arg(recorder->droppedSamples()));
+        }
+    }
+}
+
+void FrameProfiler::flushCsv()
+{
+    if (!m_csv.isOpen() || m_csvBuffer.isEmpty()) {
+        return;
+    }
+    m_csv.write(m_csvBuffer);
+    m_csv.flush();
+    m_csvBuffer.clear();
+}
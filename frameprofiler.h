@@ -0,0 +1,144 @@
+#ifndef FRAMEPROFILER_H
+#define FRAMEPROFILER_H
+
+#include "spscring.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <QOpenGLExtraFunctions>
+#include <QFile>
+#include <QStringList>
+
+namespace Timing {
+
+enum Section {
+    MpvRender,
+    Mipmaps,
+    PoseUpdate,
+    Eyes,
+    Distortion,
+    Swap,
+    SectionCount
+};
+
+const char *sectionName(int section);
+
+struct Sample
+{
+    // Steady clock, when the section started
+    qint64 timestamp = 0;
+    quint64 frame = 0;
+    int section = 0;
+    qint64 cpuNs = 0;
+    // -1 if there was no GPU query for it
+    qint64 gpuNs = -1;
+};
+
+} // namespace Timing
+
+// Measures sections on one thread, with steady clock scopes for the CPU side
+// and GL_TIME_ELAPSED queries for the GPU side. The GPU results are picked up
+// a few frames later by collect(), so we never stall on them.
+class TimingRecorder : protected QOpenGLExtraFunctions
+{
+public:
+    explicit TimingRecorder(const QByteArray &name) : m_name(name) {}
+
+    const QByteArray &name() const { return m_name; }
+
+    // With this thread's context current
+    void initializeGL();
+    void releaseGL();
+
+    void setFrame(quint64 frame) { m_frame = frame; }
+
+    // GPU queries can't be nested, so only one of the sections with gpu set
+    // can be open at a time.
+    void begin(int section, bool gpu = false);
+    void end(int section);
+
+    // Producer side, checks which GPU queries have finished
+    void collect();
+
+    // Consumer side
+    bool takeSample(Timing::Sample &sample) { return m_samples.pop(sample); }
+    quint64 droppedSamples() const { return m_dropped; }
+
+private:
+    void push(const Timing::Sample &sample);
+
+    enum {
+        QueryCount = 16
+    };
+
+    struct Pending {
+        Timing::Sample sample;
+        GLuint query = 0;
+    };
+
+    const QByteArray m_name;
+    quint64 m_frame = 0;
+
+    Pending m_open[Timing::SectionCount];
+
+    bool m_timerQueries = false;
+    GLuint m_queries[QueryCount]{};
+    // Queries in flight, in the order they were issued
+    Pending m_pending[QueryCount];
+    int m_pendingHead = 0;
+    int m_pendingCount = 0;
+
+    SpscRing<Timing::Sample, 1024> m_samples;
+    std::atomic<quint64> m_dropped{0};
+};
+
+// Collects the samples from all the recorders on the GUI thread, keeps the
+// per second averages for the HUD and optionally writes everything to a CSV
+// file.
+class FrameProfiler
+{
+public:
+    FrameProfiler();
+    ~FrameProfiler();
+
+    // Owned by the profiler, create them all before any thread starts
+    // recording.
+    TimingRecorder *addRecorder(const QByteArray &name);
+
+    bool openCsv(const QString &path);
+
+    // Call once per frame, returns true when the summary changed
+    bool consume();
+
+    QStringList summary() const { return m_summary; }
+
+    // GPU time of everything consumed since the last call, from all threads
+    qint64 takeGpuTime() { const qint64 gpuNs = m_gpuNs; m_gpuNs = 0; return gpuNs; }
+
+private:
+    struct Accumulator {
+        int count = 0;
+        int gpuCount = 0;
+        qint64 cpuNs = 0;
+        qint64 cpuMaxNs = 0;
+        qint64 gpuNs = 0;
+        qint64 gpuMaxNs = 0;
+    };
+
+    void updateSummary();
+    void flushCsv();
+
+    std::vector<std::unique_ptr<TimingRecorder>> m_recorders;
+    std::vector<Accumulator> m_accumulators;
+
+    qint64 m_startTime = 0;
+    qint64 m_windowStart = 0;
+    QStringList m_summary;
+    qint64 m_gpuNs = 0;
+
+    QFile m_csv;
+    QByteArray m_csvBuffer;
+};
+
+#endif // FRAMEPROFILER_H
@@ -1,9 +1,16 @@
 #include "widget.h"
+#include "mirrorwindow.h"
+#include "ohmdhandler.h"
+#include "startuplog.h"
+#include "vrrenderer.h"
 
 #include <QApplication>
+#include <QScopedPointer>
 
 int main(int argc, char *argv[])
 {
+    StartupLog::start();
+
     if (argc < 2) {
         qWarning() << "Please pass video";
         return 1;
@@ -11,8 +18,61 @@ int main(int argc, char *argv[])
 
     const QString videoAngle360 = "--360";
     const QString videoAngle180 = "--180";
-    char *path = nullptr;
+    const QString noTimewarp = "--no-timewarp";
+    const QString poseRateArg = "--pose-rate";
+    const QString predictArg = "--predict-ms";
+    const QString noLensCorrection = "--no-lens-correction";
+    const QString fusedEyesArg = "--fused-eyes";
+    const QString noViewportArray = "--no-viewport-array";
+    const QString viewportCropArg = "--viewport-crop";
+    const QString cropMarginArg = "--crop-margin";
+    const QString hudArg = "--hud";
+    const QString timingCsvArg = "--timing-csv";
+    const QString videoScaleArg = "--video-scale";
+    const QString noDynamicResolution = "--no-dynamic-resolution";
+    const QString noMipmaps = "--no-mipmaps";
+    const QString noTiling = "--no-tiling";
+    const QString projectionArg = "--projection";
+    const QString recordPosesArg = "--record-poses";
+    const QString replayPosesArg = "--replay-poses";
+    const QString replayFastArg = "--replay-fast";
+    const QString loopPlaylistArg = "--loop-playlist";
+    const QString noPrefetchArg = "--no-prefetch";
+    const QString noSeekPreviewsArg = "--no-seek-previews";
+    const QString noDisplaySyncArg = "--no-display-sync";
+    const QString telemetrySocketArg = "--telemetry-socket";
+    const QString mirrorArg = "--mirror";
+    const QString mirrorRateArg = "--mirror-rate";
+    const QString mirrorDistortedArg = "--mirror-distorted";
+    QByteArrayList paths;
     float videoAngle = 180;
+    bool timewarp = true;
+    int poseRate = 1000;
+    float predictionMs = -1;
+    bool lensCorrection = true;
+    bool fusedEyes = false;
+    bool viewportArrayStereo = true;
+    bool viewportCrop = false;
+    float cropMargin = 20;
+    bool showHud = false;
+    QString timingCsvPath;
+    float videoScale = 1;
+    bool dynamicResolution = true;
+    bool mipmaps = true;
+    bool tiledVideo = true;
+    VrRenderer::ProjectionFormat projectionFormat = VrRenderer::Equirectangular;
+    QString recordPosesPath;
+    QString replayPosesPath;
+    bool replayFast = false;
+    bool loopPlaylist = false;
+    bool prefetch = true;
+    bool seekPreviews = true;
+    bool displaySync = true;
+    QString telemetrySocket;
+    bool mirror = false;
+    VrRenderer::MirrorEyes mirrorEyes = VrRenderer::MirrorBothEyes;
+    float mirrorRate = 30;
+    bool mirrorDistorted = false;
     if (argc > 2) {
         for (int i=1; i<argc; i++) {
             if (argv[i] == videoAngle180) {
@@ -23,14 +83,151 @@ int main(int argc, char *argv[])
                 videoAngle = 360;
                 continue;
             }
-            if (path != nullptr) {
-                qWarning() << "Usage:" << argv[0] << "[--360|--180] videofile";
-                return 1;
+            if (argv[i] == noTimewarp) {
+                timewarp = false;
+                continue;
+            }
+            if (argv[i] == poseRateArg && i + 1 < argc) {
+                poseRate = QString(argv[++i]).toInt();
+                if (poseRate <= 0) {
+                    qWarning() << "Invalid pose rate" << argv[i];
+                    return 1;
+                }
+                continue;
+            }
+            if (argv[i] == noLensCorrection) {
+                lensCorrection = false;
+                continue;
+            }
+            if (argv[i] == fusedEyesArg) {
+                fusedEyes = true;
+                continue;
+            }
+            if (argv[i] == noViewportArray) {
+                viewportArrayStereo = false;
+                continue;
+            }
+            if (argv[i] == viewportCropArg) {
+                viewportCrop = true;
+                continue;
+            }
+            if (argv[i] == cropMarginArg && i + 1 < argc) {
+                cropMargin = QString(argv[++i]).toFloat();
+                continue;
+            }
+            if (argv[i] == hudArg) {
+                showHud = true;
+                continue;
+            }
+            if (argv[i] == timingCsvArg && i + 1 < argc) {
+                timingCsvPath = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (argv[i] == videoScaleArg && i + 1 < argc) {
+                videoScale = QString(argv[++i]).toFloat();
+                continue;
+            }
+            if (argv[i] == noDynamicResolution) {
+                dynamicResolution = false;
+                continue;
+            }
+            if (argv[i] == noMipmaps) {
+                mipmaps = false;
+                continue;
+            }
+            if (argv[i] == noTiling) {
+                tiledVideo = false;
+                continue;
+            }
+            if (argv[i] == projectionArg && i + 1 < argc) {
+                const QString format = argv[++i];
+                if (format == "equirect") {
+                    projectionFormat = VrRenderer::Equirectangular;
+                } else if (format == "eac") {
+                    projectionFormat = VrRenderer::EquiAngularCubemap;
+                } else if (format == "cubemap") {
+                    projectionFormat = VrRenderer::Cubemap;
+                } else {
+                    qWarning() << "Unknown projection" << format << "expected equirect, eac or cubemap";
+                    return 1;
+                }
+                continue;
+            }
+            if (argv[i] == recordPosesArg && i + 1 < argc) {
+                recordPosesPath = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (argv[i] == replayPosesArg && i + 1 < argc) {
+                replayPosesPath = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (argv[i] == replayFastArg) {
+                replayFast = true;
+                continue;
+            }
+            if (argv[i] == predictArg && i + 1 < argc) {
+                predictionMs = QString(argv[++i]).toFloat();
+                continue;
+            }
+            if (argv[i] == loopPlaylistArg) {
+                loopPlaylist = true;
+                continue;
+            }
+            if (argv[i] == noPrefetchArg) {
+                prefetch = false;
+                continue;
+            }
+            if (argv[i] == noSeekPreviewsArg) {
+                seekPreviews = false;
+                continue;
+            }
+            if (argv[i] == noDisplaySyncArg) {
+                displaySync = false;
+                continue;
+            }
+            if (argv[i] == telemetrySocketArg && i + 1 < argc) {
+                telemetrySocket = QString::fromLocal8Bit(argv[++i]);
+                continue;
+            }
+            if (argv[i] == mirrorArg && i + 1 < argc) {
+                const QString eyes = argv[++i];
+                if (eyes == "both") {
+                    mirrorEyes = VrRenderer::MirrorBothEyes;
+                } else if (eyes == "left") {
+                    mirrorEyes = VrRenderer::MirrorLeftEye;
+                } else if (eyes == "right") {
+                    mirrorEyes = VrRenderer::MirrorRightEye;
+                } else {
+                    qWarning() << "Unknown mirror" << eyes << "expected both, left or right";
+                    return 1;
+                }
+                mirror = true;
+                continue;
+            }
+            if (argv[i] == mirrorRateArg && i + 1 < argc) {
+                mirrorRate = QString(argv[++i]).toFloat();
+                if (mirrorRate <= 0) {
+                    qWarning() << "Invalid mirror rate" << argv[i];
+                    return 1;
+                }
+                continue;
+            }
+            if (argv[i] == mirrorDistortedArg) {
+                mirrorDistorted = true;
+                continue;
+            }
+            if (QByteArray(argv[i]).startsWith("--")) {
+                paths.clear();
+                break;
             }
-            path = argv[i];
+            paths << argv[i];
         }
     } else {
-        path = argv[1];
+        paths << argv[1];
+    }
+    if (paths.isEmpty()) {
+        qWarning() << "Usage:" << argv[0] << "[--360|--180] [--no-timewarp] [--pose-rate hz] [--predict-ms ms] [--no-lens-correction] [--fused-eyes] [--no-viewport-array] [--viewport-crop] [--crop-margin degrees] [--hud] [--timing-csv file] [--video-scale s] [--no-dynamic-resolution] [--no-mipmaps] [--no-tiling] [--projection equirect|eac|cubemap] [--record-poses file] [--replay-poses file [--replay-fast]] [--loop-playlist] [--no-prefetch] [--no-seek-previews] [--no-display-sync] [--telemetry-socket path] [--mirror both|left|right [--mirror-rate hz] [--mirror-distorted]] videofile...";
+        return 1;
     }
 
     QSurfaceFormat format;
@@ -40,10 +237,55 @@ int main(int argc, char *argv[])
     format.setSamples(4);
     QSurfaceFormat::setDefaultFormat(format);
 
+    // mpv renders on its own thread, into textures the window samples from
+    QCoreApplication::setAttribute(Qt::AA_ShareOpenGLContexts);
+
     QApplication a(argc, argv);
+    StartupLog::mark("application created");
     MpvWidget w;
-    w.videoAngle = videoAngle;
+    w.renderer()->videoAngle = videoAngle;
+    w.timewarp = timewarp;
+    w.ohmd()->pollRate = poseRate;
+    w.renderer()->predictionMs = predictionMs;
+    w.renderer()->lensCorrection = lensCorrection;
+    w.renderer()->fusedEyes = fusedEyes;
+    w.renderer()->viewportArrayStereo = viewportArrayStereo;
+    w.renderer()->viewportCrop = viewportCrop;
+    w.renderer()->cropMargin = cropMargin;
+    w.renderer()->showHud = showHud;
+    w.renderer()->videoScale = videoScale;
+    w.renderer()->dynamicResolution = dynamicResolution;
+    w.renderer()->mipmaps = mipmaps;
+    w.renderer()->tiledVideo = tiledVideo;
+    w.renderer()->projectionFormat = projectionFormat;
+    w.timingCsvPath = timingCsvPath;
+    if (!replayPosesPath.isEmpty() &&
+            !w.ohmd()->startReplay(replayPosesPath, replayFast ? OhmdHandler::ReplayFast : OhmdHandler::ReplayRealtime)) {
+        return 1;
+    }
+    if (!recordPosesPath.isEmpty() && !w.ohmd()->startRecording(recordPosesPath)) {
+        return 1;
+    }
+    w.loopPlaylist = loopPlaylist;
+    w.prefetch = prefetch;
+    w.seekPreviews = seekPreviews;
+    w.displaySync = displaySync;
+    if (!telemetrySocket.isEmpty()) {
+        w.startTelemetry(telemetrySocket);
+    }
+
+    QScopedPointer<MirrorWindow> mirrorWindow;
+    if (mirror) {
+        w.renderer()->mirrorRate = mirrorRate;
+        w.renderer()->mirrorEyes = mirrorEyes;
+        w.renderer()->mirrorDistorted = mirrorDistorted;
+        mirrorWindow.reset(new MirrorWindow(&w, w.renderer()));
+        mirrorWindow->show();
+    }
+
+    // Loaded as soon as mpv's render context is up, while the window is
+    // still being created
+    w.play(paths);
     w.show();
-    w.play(path);
     return a.exec();
 }
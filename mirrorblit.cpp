@@ -0,0 +1,49 @@
+#include "mirrorblit.h"
+
+void MirrorBlit::initializeGL()
+{
+    initializeOpenGLFunctions();
+    glGenFramebuffers(1, &m_readFbo);
+}
+
+void MirrorBlit::releaseGL()
+{
+    if (m_readFbo) {
+        glDeleteFramebuffers(1, &m_readFbo);
+        m_readFbo = 0;
+    }
+    // Owned by the renderer
+    m_texture = 0;
+    m_rect = QRect();
+}
+
+void MirrorBlit::present(VrRenderer *renderer, GLuint targetFbo, const QSize &targetSize)
+{
+    const VrRenderer::MirrorFrame frame = renderer->takeMirrorFrame();
+    if (frame.texture) {
+        // Waits on the GPU, not here
+        glWaitSync(frame.fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.fence);
+        m_texture = frame.texture;
+        m_rect = frame.rect;
+    }
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targetFbo);
+    glViewport(0, 0, targetSize.width(), targetSize.height());
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (!m_texture || m_rect.isEmpty()) {
+        return;
+    }
+
+    // FBOs aren't shared between contexts, textures are
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_texture, 0);
+
+    // Only the eyes we mirror
+    const QSize size = m_rect.size().scaled(targetSize, Qt::KeepAspectRatio);
+    const int x = (targetSize.width() - size.width()) / 2;
+    const int y = (targetSize.height() - size.height()) / 2;
+    glBlitFramebuffer(m_rect.left(), m_rect.top(), m_rect.right() + 1, m_rect.bottom() + 1,
+                      x, y, x + size.width(), y + size.height(), GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+}
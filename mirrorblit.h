@@ -0,0 +1,28 @@
+#ifndef MIRRORBLIT_H
+#define MIRRORBLIT_H
+
+#include "vrrenderer.h"
+
+#include <QOpenGLExtraFunctions>
+
+// The desktop side of the mirror: shows the newest copy VrRenderer made of
+// what the headset got (see VrRenderer::mirrorRate) with one blit, in
+// whatever context is current. The target can't be multisampled.
+class MirrorBlit : protected QOpenGLExtraFunctions
+{
+public:
+    // With the context current
+    void initializeGL();
+    void releaseGL();
+
+    // Picks up the newest copy if there is one, and blits the current one
+    // into the target keeping its aspect ratio
+    void present(VrRenderer *renderer, GLuint targetFbo, const QSize &targetSize);
+
+private:
+    GLuint m_readFbo = 0;
+    GLuint m_texture = 0;
+    QRect m_rect;
+};
+
+#endif // MIRRORBLIT_H
@@ -0,0 +1,54 @@
+#include "mirrorwindow.h"
+
+#include <QGuiApplication>
+#include <QOpenGLContext>
+#include <QScreen>
+
+MirrorWindow::MirrorWindow(QOpenGLWindow *hmdWindow, VrRenderer *renderer) :
+    QOpenGLWindow(QOpenGLContext::globalShareContext()),
+    m_renderer(renderer)
+{
+    setTitle("Mirror");
+
+    // Blits can't go into a multisampled buffer, and a swap waiting for the
+    // desktop's vsync would delay the headset's next frame
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setSamples(0);
+    format.setSwapInterval(0);
+    setFormat(format);
+
+    // The headset window ends up on the headset, we stay on the desktop
+    const QRect desktop = QGuiApplication::primaryScreen()->availableGeometry();
+    setGeometry(QRect(desktop.topLeft() + QPoint(50, 50), QSize(960, 540)));
+
+    connect(hmdWindow, &QOpenGLWindow::frameSwapped, this, &MirrorWindow::onHmdFrameSwapped);
+    connect(hmdWindow, &QWindow::visibleChanged, this, [this](bool visible) {
+        if (!visible) {
+            close();
+        }
+    });
+}
+
+MirrorWindow::~MirrorWindow()
+{
+    makeCurrent();
+    m_blit.releaseGL();
+    doneCurrent();
+}
+
+void MirrorWindow::initializeGL()
+{
+    m_blit.initializeGL();
+}
+
+void MirrorWindow::paintGL()
+{
+    m_blit.present(m_renderer, defaultFramebufferObject(), size() * devicePixelRatio());
+}
+
+void MirrorWindow::onHmdFrameSwapped()
+{
+    if (m_renderer->hasMirrorFrame()) {
+        update();
+    }
+}
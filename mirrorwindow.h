@@ -0,0 +1,29 @@
+#ifndef MIRRORWINDOW_H
+#define MIRRORWINDOW_H
+
+#include "mirrorblit.h"
+
+#include <QOpenGLWindow>
+
+// Shows what the headset gets on the desktop, at VrRenderer::mirrorRate.
+// Only repaints when the headset window made a new copy, and never waits
+// for vsync, so it can't hold up the headset window on the same thread.
+class MirrorWindow : public QOpenGLWindow
+{
+    Q_OBJECT
+public:
+    MirrorWindow(QOpenGLWindow *hmdWindow, VrRenderer *renderer);
+    ~MirrorWindow();
+
+protected:
+    void initializeGL() override;
+    void paintGL() override;
+
+private:
+    void onHmdFrameSwapped();
+
+    VrRenderer *m_renderer;
+    MirrorBlit m_blit;
+};
+
+#endif // MIRRORWINDOW_H
@@ -0,0 +1,154 @@
+#include "mpveventpump.h"
+
+#include "startuplog.h"
+#include "steadyclock.h"
+
+#include <QDebug>
+
+MpvEventPump::MpvEventPump(mpv_handle *mpv, QObject *parent) : QThread(parent),
+    m_mpv(mpv)
+{
+    setObjectName("MpvEventPump");
+}
+
+MpvEventPump::~MpvEventPump()
+{
+    stopPump();
+}
+
+void MpvEventPump::startPump()
+{
+    if (isRunning()) {
+        return;
+    }
+
+    mpv_observe_property(m_mpv, Duration, "duration", MPV_FORMAT_DOUBLE);
+    mpv_observe_property(m_mpv, PlaybackTime, "playback-time", MPV_FORMAT_DOUBLE);
+    mpv_observe_property(m_mpv, Width, "width", MPV_FORMAT_INT64);
+    mpv_observe_property(m_mpv, Height, "height", MPV_FORMAT_INT64);
+    mpv_observe_property(m_mpv, PlaylistPos, "playlist-pos", MPV_FORMAT_INT64);
+    mpv_observe_property(m_mpv, Path, "path", MPV_FORMAT_STRING);
+
+    m_running = true;
+    start();
+}
+
+void MpvEventPump::stopPump()
+{
+    if (!isRunning()) {
+        return;
+    }
+    m_running = false;
+    mpv_wakeup(m_mpv);
+    wait();
+}
+
+void MpvEventPump::run()
+{
+    while (m_running) {
+        // Sleep until mpv has something, then take everything it has queued
+        // up by then in one go
+        const mpv_event *event = mpv_wait_event(m_mpv, -1);
+        if (event->event_id == MPV_EVENT_NONE) {
+            continue;
+        }
+
+        const MpvState previous = m_state;
+        int batch = 0;
+        while (event->event_id != MPV_EVENT_NONE) {
+            handleEvent(event);
+            batch++;
+            if (event->event_id == MPV_EVENT_SHUTDOWN) {
+                m_running = false;
+                break;
+            }
+            event = mpv_wait_event(m_mpv, 0);
+        }
+
+        m_state.serial++;
+        m_states.writeBuffer() = m_state;
+        m_states.publish();
+
+        if (m_state.videoSize != previous.videoSize) {
+            emit videoSizeChanged(m_state.videoSize);
+        }
+        if (m_state.path != previous.path) {
+            emit pathChanged(m_state.path);
+        }
+        if (int(m_state.duration * 1000) != int(previous.duration * 1000)) {
+            emit durationChanged(m_state.duration * 1000);
+        }
+        if (int(m_state.position * 1000) != int(previous.position * 1000)) {
+            emit positionChanged(m_state.position * 1000);
+        }
+        if (batch > 100) {
+            qDebug() << "coalesced" << batch << "mpv events";
+        }
+    }
+}
+
+void MpvEventPump::handleEvent(const mpv_event *event)
+{
+    switch (event->event_id) {
+    case MPV_EVENT_PROPERTY_CHANGE:
+        handleProperty(event->reply_userdata, static_cast<const mpv_event_property *>(event->data));
+        break;
+    case MPV_EVENT_FILE_LOADED:
+        StartupLog::mark("file loaded");
+        break;
+    case MPV_EVENT_END_FILE:
+        m_endFileNs = SteadyClock::nowNs();
+        break;
+    case MPV_EVENT_START_FILE:
+        // A switch starts when the previous entry stopped, with prefetching
+        // the next one was opened well before that
+        m_switchStartNs = m_endFileNs ? m_endFileNs : SteadyClock::nowNs();
+        m_endFileNs = 0;
+        break;
+    case MPV_EVENT_PLAYBACK_RESTART: {
+        // Also sent after seeks, only the first one after a new entry counts
+        if (!m_switchStartNs) {
+            break;
+        }
+        const qint64 duration = SteadyClock::nowNs() - m_switchStartNs;
+        m_switchStartNs = 0;
+        m_state.lastSwitchNs = duration;
+        m_switches++;
+        m_switchTotalNs += duration;
+        m_switchMaxNs = qMax(m_switchMaxNs, duration);
+        qDebug() << "switched to playlist entry" << m_state.playlistPos << "in" << duration / 1e6 << "ms, mean"
+                 << m_switchTotalNs / m_switches / 1e6 << "max" << m_switchMaxNs / 1e6 << "ms over" << m_switches << "switches";
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void MpvEventPump::handleProperty(quint64 id, const mpv_event_property *property)
+{
+    const bool isDouble = property->format == MPV_FORMAT_DOUBLE;
+    const bool isInt = property->format == MPV_FORMAT_INT64;
+    switch (id) {
+    case Duration:
+        m_state.duration = isDouble ? *static_cast<double *>(property->data) : 0;
+        break;
+    case PlaybackTime:
+        m_state.position = isDouble ? *static_cast<double *>(property->data) : 0;
+        break;
+    case Width:
+        m_state.videoSize.setWidth(isInt ? *static_cast<int64_t *>(property->data) : 0);
+        break;
+    case Height:
+        m_state.videoSize.setHeight(isInt ? *static_cast<int64_t *>(property->data) : 0);
+        break;
+    case PlaylistPos:
+        m_state.playlistPos = isInt ? *static_cast<int64_t *>(property->data) : -1;
+        break;
+    case Path:
+        m_state.path = property->format == MPV_FORMAT_STRING ? QByteArray(*static_cast<char **>(property->data)) : QByteArray();
+        break;
+    default:
+        break;
+    }
+}
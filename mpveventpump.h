@@ -0,0 +1,86 @@
+#ifndef MPVEVENTPUMP_H
+#define MPVEVENTPUMP_H
+
+#include "triplebuffer.h"
+
+#include <mpv/client.h>
+#include <atomic>
+#include <QThread>
+#include <QSize>
+
+// What we know about the playback, as of the last batch of mpv events
+struct MpvState
+{
+    double duration = 0;
+    double position = 0;
+    QSize videoSize;
+    QByteArray path;
+    int playlistPos = -1;
+
+    // How long the last switch to the next playlist entry (or opening the
+    // first one) took until mpv had its first frame ready, -1 if none yet
+    qint64 lastSwitchNs = -1;
+
+    // Bumped for every published batch
+    quint64 serial = 0;
+};
+
+// Drains mpv's events on its own thread, so a storm of them (seeking,
+// switching streams) never holds up the GUI thread that renders. Everything
+// mpv had queued up is handled as one batch and published once, the render
+// thread picks the newest snapshot up without locking.
+class MpvEventPump : public QThread
+{
+    Q_OBJECT
+
+public:
+    MpvEventPump(mpv_handle *mpv, QObject *parent);
+    ~MpvEventPump();
+
+    // Observes the properties, call before mpv gets busy
+    void startPump();
+    void stopPump();
+
+    // Render thread side, returns true if there is a newer snapshot
+    bool update() { return m_states.update(); }
+    const MpvState &state() const { return m_states.readBuffer(); }
+
+signals:
+    // Once per batch at most, queued to whoever listens
+    void videoSizeChanged(const QSize &size);
+    void pathChanged(const QByteArray &path);
+    void durationChanged(int milliseconds);
+    void positionChanged(int milliseconds);
+
+protected:
+    void run() override;
+
+private:
+    // Passed to mpv_observe_property() as reply_userdata
+    enum Property : quint64 {
+        Duration = 1,
+        PlaybackTime,
+        Width,
+        Height,
+        PlaylistPos,
+        Path
+    };
+
+    void handleEvent(const mpv_event *event);
+    void handleProperty(quint64 id, const mpv_event_property *property);
+
+    mpv_handle *m_mpv;
+    std::atomic_bool m_running{false};
+
+    // Only touched by the pump thread
+    MpvState m_state;
+    qint64 m_endFileNs = 0;
+    qint64 m_switchStartNs = 0;
+    int m_switches = 0;
+    qint64 m_switchTotalNs = 0;
+    qint64 m_switchMaxNs = 0;
+
+    TripleBuffer<MpvState> m_states;
+};
+
+#endif // MPVEVENTPUMP_H
@@ -1,24 +1,69 @@
 #include "ohmdhandler.h"
 
+#include "startuplog.h"
+#include "steadyclock.h"
+
 #include <openhmd.h>
 #include <QDebug>
+#include <thread>
+
+class PoseThread : public QThread
+{
+public:
+    PoseThread(OhmdHandler *handler) : QThread(handler), m_handler(handler) {}
 
-OhmdHandler::OhmdHandler(QObject *parent) : QObject(parent)
+protected:
+    void run() override { m_handler->poseLoop(); }
+
+private:
+    OhmdHandler *m_handler;
+};
+
+OhmdHandler::OhmdHandler(QObject *parent, const QByteArray &product) : QObject(parent),
+    m_product(product)
 {
 //    m_modelViewMatrices.first.setToIdentity();
 //    m_modelViewMatrices.second.setToIdentity();
 
-    init();
+    m_traceTimer.setInterval(50);
+    connect(&m_traceTimer, &QTimer::timeout, this, &OhmdHandler::writeTrace);
+
+    // The pose thread opens the device before it starts polling
+    startPoseThread();
 }
 
 OhmdHandler::~OhmdHandler()
 {
-    isRunning = false;
+    stopPoseThread();
+    stopRecording();
+    if (m_ohmdContext) {
+        ohmd_ctx_destroy(m_ohmdContext);
+    }
+}
+
+bool OhmdHandler::waitForInit()
+{
+    QMutexLocker locker(&m_initMutex);
+    while (!m_initialized) {
+        m_initDone.wait(&m_initMutex);
+    }
+    return m_initOk;
 }
 
-bool OhmdHandler::init()
+void OhmdHandler::finishInit(bool ok)
+{
+    StartupLog::mark(ok ? "hmd opened" : "no hmd");
+
+    QMutexLocker locker(&m_initMutex);
+    m_initialized = true;
+    m_initOk = ok;
+    m_initDone.wakeAll();
+}
+
+bool OhmdHandler::init(const QByteArray &product)
 {
     qDebug() << "starting ohmd thread";
+    StartupLog::mark("probing hmd");
     m_ohmdContext = ohmd_ctx_create();
     int num_devices = ohmd_ctx_probe(m_ohmdContext);
     if(num_devices < 0){
@@ -39,24 +84,38 @@ bool OhmdHandler::init()
 //    qDebug() << "================\n"
 //             << distortionVertShader;
 
+    int deviceIndex = 0;
+    if (!product.isEmpty()) {
+        deviceIndex = -1;
+        for (int i = 0; i < num_devices; i++) {
+            if (product == ohmd_list_gets(m_ohmdContext, i, OHMD_PRODUCT)) {
+                deviceIndex = i;
+                break;
+            }
+        }
+        if (deviceIndex < 0) {
+            qWarning() << "No device" << product << "found";
+            return false;
+        }
+    }
+
     ohmd_device_settings* settings = ohmd_device_settings_create(m_ohmdContext);
 
     // If OHMD_IDS_AUTOMATIC_UPDATE is set to 0, ohmd_ctx_update() must be called at least 10 times per second.
-    // It is enabled by default.
+    // It is enabled by default, but our pose thread does the polling itself.
 
-    int auto_update = 1;
+    int auto_update = 0;
     ohmd_device_settings_seti(settings, OHMD_IDS_AUTOMATIC_UPDATE, &auto_update);
 
-    m_ohmdDevice = ohmd_list_open_device_s(m_ohmdContext, 0, settings);
+    m_ohmdDevice = ohmd_list_open_device_s(m_ohmdContext, deviceIndex, settings);
     if(!m_ohmdDevice){
         printf("failed to open device: %s\n", ohmd_ctx_get_error(m_ohmdContext));
         return false;
     }
 
 
-    const char *vendor = ohmd_list_gets(m_ohmdContext, 0, OHMD_VENDOR);
-    const char *product = ohmd_list_gets(m_ohmdContext, 0, OHMD_PRODUCT);
-    qDebug() << vendor << product;
+    const char *vendor = ohmd_list_gets(m_ohmdContext, deviceIndex, OHMD_VENDOR);
+    qDebug() << vendor << ohmd_list_gets(m_ohmdContext, deviceIndex, OHMD_PRODUCT);
 
     int hmd_w = 0, hmd_h = 0;
     ohmd_device_geti(m_ohmdDevice, OHMD_SCREEN_HORIZONTAL_RESOLUTION, &hmd_w);
@@ -105,37 +164,266 @@ bool OhmdHandler::init()
 
     ohmd_device_settings_destroy(settings);
 
+    float matrix[16];
+    ohmd_device_getf(m_ohmdDevice, OHMD_LEFT_EYE_GL_PROJECTION_MATRIX, matrix);
+    m_projection[0] = QMatrix4x4(matrix).inverted();
+    ohmd_device_getf(m_ohmdDevice, OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, matrix);
+    m_projection[1] = QMatrix4x4(matrix).inverted();
+    projection[0] = m_projection[0];
+    projection[1] = m_projection[1];
+
     return true;
 }
 
-void OhmdHandler::update()
+DistortionParams OhmdHandler::distortionParams() const
 {
+    DistortionParams params;
+    if (!m_ohmdDevice) {
+        return params;
+    }
+
+    params.viewportScale[0] = viewport_scale[0];
+    params.viewportScale[1] = viewport_scale[1];
+    params.leftLensCenter[0] = left_lens_center[0];
+    params.leftLensCenter[1] = left_lens_center[1];
+    params.rightLensCenter[0] = right_lens_center[0];
+    params.rightLensCenter[1] = right_lens_center[1];
+    params.warpScale = warp_scale * warp_adj;
+    for (int i = 0; i < 4; i++) {
+        params.coefficients[i] = distortion_coeffs[i];
+    }
+    for (int i = 0; i < 3; i++) {
+        params.aberration[i] = aberr_scale[i];
+    }
+    return params;
+}
 
+void OhmdHandler::update(qint64 targetTime)
+{
+    if (m_replaying && m_replayMode == ReplayFast) {
+        publishReplayPose(m_replayTime, SteadyClock::nowNs());
+        m_replayTime += m_replayStep;
+    }
+
+    if (m_poses.update()) {
+        m_predictor.evaluate(m_poses.readBuffer().history);
+    }
+
+    const PoseSnapshot &pose = m_poses.readBuffer();
+    projection[0] = pose.projection[0];
+    projection[1] = pose.projection[1];
+    poseTimestamp = pose.timestamp;
+
+    if (targetTime <= 0 || pose.timestamp == 0) {
+        modelView[0] = pose.modelView[0];
+        modelView[1] = pose.modelView[1];
+        return;
+    }
+
+    // Don't extrapolate too far if the pose thread is stalled
+    const qint64 maxPrediction = 100000000;
+    const qint64 dt = qBound(qint64(0), targetTime - pose.timestamp, maxPrediction);
+    const QQuaternion predicted = PosePredictor::predict(pose.orientation, pose.angularVelocity, dt);
+
+    // The rotation part of our (inverted and transposed) modelview is the
+    // view rotation, i.e. the inverse of the head orientation, so swap the
+    // current orientation out for the predicted one on the right.
+    QMatrix4x4 correction;
+    correction.rotate(pose.orientation * predicted.conjugated());
+    modelView[0] = pose.modelView[0] * correction;
+    modelView[1] = pose.modelView[1] * correction;
+
+    m_predictor.addPrediction(pose.timestamp + dt, predicted, pose.orientation);
+}
+
+void OhmdHandler::startPoseThread()
+{
+    isRunning = true;
+    if (!m_poseThread) {
+        m_poseThread = new PoseThread(this);
+        m_poseThread->setObjectName("OhmdPoseThread");
+    }
+    m_poseThread->start(QThread::TimeCriticalPriority);
+}
+
+void OhmdHandler::stopPoseThread()
+{
+    isRunning = false;
+    if (m_poseThread) {
+        m_poseThread->wait();
+    }
+}
+
+void OhmdHandler::poseLoop()
+{
+    if (!m_initialized) {
+        const bool ok = init(m_product);
+        finishInit(ok);
+        if (!ok) {
+            isRunning = false;
+            return;
+        }
+    }
+
+    if (m_replaying) {
+        replayLoop();
+    } else {
+        pollLoop();
+    }
+}
+
+void OhmdHandler::publishPose(qint64 timestamp, const QQuaternion &orientation, const QMatrix4x4 modelView[2])
+{
+    PoseSnapshot &pose = m_poses.writeBuffer();
+    pose.timestamp = timestamp;
+    pose.modelView[0] = modelView[0];
+    pose.modelView[1] = modelView[1];
+    pose.projection[0] = m_projection[0];
+    pose.projection[1] = m_projection[1];
+    pose.orientation = orientation;
+
+    m_history.add(timestamp, orientation);
+    pose.angularVelocity = m_history.angularVelocity();
+    pose.history = m_history;
+
+    m_poses.publish();
+
+    if (m_recording) {
+        PoseTraceRecord record;
+        record.timestamp = timestamp;
+        record.orientation = orientation;
+        record.modelView[0] = modelView[0];
+        record.modelView[1] = modelView[1];
+        if (!m_traceQueue.push(record)) {
+            qWarning() << "pose trace queue full, dropping pose";
+        }
+    }
+}
+
+void OhmdHandler::pollLoop()
+{
+    qDebug() << "pose thread running at" << pollRate << "Hz";
+
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (isRunning) {
         ohmd_ctx_update(m_ohmdContext);
+        const qint64 timestamp = SteadyClock::nowNs();
 
         float matrix[16];
+        QMatrix4x4 modelView[2];
         ohmd_device_getf(m_ohmdDevice, OHMD_LEFT_EYE_GL_MODELVIEW_MATRIX, matrix);
         modelView[0] = QMatrix4x4(matrix).inverted();
 
         ohmd_device_getf(m_ohmdDevice, OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, matrix);
         modelView[1] = QMatrix4x4(matrix).inverted();
 
-        ohmd_device_getf(m_ohmdDevice, OHMD_LEFT_EYE_GL_PROJECTION_MATRIX, matrix);
-        projection[0] = QMatrix4x4(matrix).inverted();
-        ohmd_device_getf(m_ohmdDevice, OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, matrix);
-        projection[1] = QMatrix4x4(matrix).inverted();
+        float quat[4];
+        ohmd_device_getf(m_ohmdDevice, OHMD_ROTATION_QUAT, quat);
+        publishPose(timestamp, QQuaternion(quat[3], quat[0], quat[1], quat[2]), modelView);
+
+        next += std::chrono::nanoseconds(1000000000 / qMax(1, pollRate.load()));
+
+        // Don't try to catch up if we got stalled, just carry on from now
+        const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now;
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
+
+bool OhmdHandler::startReplay(const QString &path, ReplayMode mode, qint64 fastStep)
+{
+    PoseTrace trace;
+    if (!trace.load(path)) {
+        return false;
+    }
+
+    stopPoseThread();
+    m_replay = trace;
+    m_replaying = true;
+    m_replayMode = mode;
+    m_replayIndex = 0;
+    m_replayTime = 0;
+    m_replayStep = qMax(qint64(1), fastStep);
+    m_history = PoseHistory();
+
+    // The recorded projections replace the device's, the lens parameters
+    // still come from the device (if there is one).
+    m_projection[0] = m_replay.projection[0];
+    m_projection[1] = m_replay.projection[1];
+    projection[0] = m_projection[0];
+    projection[1] = m_projection[1];
 
-        //ohmd_device_getf(m_ohmdDevice, OHMD_RIGHT_EYE_GL_MODELVIEW_MATRIX, modelView[1].data());
+    qDebug() << "replaying poses from" << path << (mode == ReplayFast ? "stepped per frame" : "in real time");
 
-        //ohmd_device_getf(m_ohmdDevice, OHMD_LEFT_EYE_GL_PROJECTION_MATRIX, projection[0].data());
-        //ohmd_device_getf(m_ohmdDevice, OHMD_RIGHT_EYE_GL_PROJECTION_MATRIX, projection[1].data());
+    if (mode == ReplayRealtime) {
+        startPoseThread();
+    } else {
+        // update() produces the poses on the render thread
+        isRunning = true;
+    }
+    return true;
+}
+
+void OhmdHandler::publishReplayPose(qint64 replayTime, qint64 timestamp)
+{
+    // Loop forever
+    const qint64 duration = m_replay.duration();
+    const qint64 traceTime = duration > 0 ? replayTime % (duration + 1) : 0;
+    m_replayIndex = m_replay.indexAt(traceTime, m_replayIndex);
+
+    const PoseTraceRecord &record = m_replay.record(m_replayIndex);
+    publishPose(timestamp, record.orientation, record.modelView);
+}
+
+void OhmdHandler::replayLoop()
+{
+    const qint64 start = SteadyClock::nowNs();
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now();
+    while (isRunning) {
+        const qint64 now = SteadyClock::nowNs();
+        publishReplayPose(now - start, now);
 
-//        m_modelViewMatrices.first = QMatrix4x4(leftMatrix).inverted();
-        //m_modelViewMatrices[0] = QMatrix4x4(leftMvMatrix).inverted();
-        //m_modelViewMatrices[1] = QMatrix4x4(rightMvMatrix).inverted();
-        //m_modelViewMatrices[2] = QMatrix4x4(leftPMatrix);
-        //m_modelViewMatrices[3] = QMatrix4x4(rightPMatrix);
-//        qDebug() << m_modelViewMatrices.first;
-//        m_modelViewMatrices.second = QMatrix4x4(rightMatrix).inverted();
+        // Same rate as we poll the device, the trace picks whatever pose was
+        // current at that time.
+        next += std::chrono::nanoseconds(1000000000 / qMax(1, pollRate.load()));
+        const std::chrono::steady_clock::time_point current = std::chrono::steady_clock::now();
+        if (next < current) {
+            next = current;
+        }
+        std::this_thread::sleep_until(next);
+    }
+}
 
+bool OhmdHandler::startRecording(const QString &path)
+{
+    waitForInit();
+    stopRecording();
+    if (!m_traceWriter.open(path, m_projection)) {
+        return false;
+    }
+    m_recording = true;
+    m_traceTimer.start();
+    qDebug() << "recording poses to" << path;
+    return true;
+}
+
+void OhmdHandler::stopRecording()
+{
+    if (!m_traceWriter.isOpen()) {
+        return;
+    }
+    m_recording = false;
+    m_traceTimer.stop();
+    writeTrace();
+    m_traceWriter.close();
+}
+
+void OhmdHandler::writeTrace()
+{
+    PoseTraceRecord record;
+    while (m_traceQueue.pop(record)) {
+        m_traceWriter.write(record);
+    }
 }
@@ -1,24 +1,56 @@
 #ifndef OHMDHANDLER_H
 #define OHMDHANDLER_H
 
+#include "triplebuffer.h"
+#include "posepredictor.h"
+#include "distortionmesh.h"
+#include "posetrace.h"
+#include "spscring.h"
+
 #include <atomic>
+#include <QMutex>
 #include <QThread>
+#include <QWaitCondition>
 #include <QMatrix4x4>
+#include <QTimer>
 
 struct ohmd_context;
 struct ohmd_device;
 
+struct PoseSnapshot
+{
+    // When the pose was read from the device, SteadyClock::nowNs()
+    qint64 timestamp = 0;
+
+    QMatrix4x4 modelView[2];
+    QMatrix4x4 projection[2];
+
+    QQuaternion orientation;
+    QVector3D angularVelocity;
+    PoseHistory history;
+};
+
 class OhmdHandler : public QObject
 {
     Q_OBJECT
 
 public:
-    OhmdHandler(QObject *parent);
+    // Opens the first device, or the first one with the given product name
+    // (e.g. "Dummy Device" for OpenHMD's dummy driver). Probing enumerates
+    // USB devices and can take a while, so it happens on the pose thread.
+    OhmdHandler(QObject *parent, const QByteArray &product = QByteArray());
     ~OhmdHandler();
 
-    bool init();
+    bool init(const QByteArray &product = QByteArray());
+
+    // Blocks until the device is probed, returns whether it could be opened.
+    // Everything below but the poses is only valid after this.
+    bool waitForInit();
 
-    std::atomic_bool isRunning;
+    std::atomic_bool isRunning{false};
+
+    // How often the pose thread polls the device, in Hz
+    std::atomic_int pollRate{1000};
 
     QMatrix4x4 rightProjection;
     QMatrix4x4 leftProjection;
@@ -26,7 +58,15 @@ public:
     QMatrix4x4 modelView[2];
     QMatrix4x4 projection[2];
 
-    void update();
+    // Picks up the newest pose published by the pose thread, never blocks.
+    // If targetTime is set the orientation is extrapolated to that time.
+    void update(qint64 targetTime = 0);
+
+    // Prediction error since the last call
+    PosePredictor::Stats takePredictionStats() { return m_predictor.takeStats(); }
+
+    // When the pose currently in modelView/projection was sampled
+    qint64 poseTimestamp = 0;
 
     const char *distortionFragShader = nullptr;
     const char *distortionVertShader = nullptr;
@@ -35,18 +75,89 @@ public:
 
     //viewport is half the screen
     float viewport_scale[2]{};
-    float aberr_scale[3];
+    float aberr_scale[3]{1.f, 1.f, 1.f};
     float warp_scale = 1.f;
     float warp_adj = 1.0f;
-    float distortion_coeffs[4];
+    float distortion_coeffs[4]{0.f, 0.f, 0.f, 1.f};
     float left_lens_center[2]{};
     float right_lens_center[2]{};
 
     float horiz_sep = 0.;
 
+    DistortionParams distortionParams() const;
+
+    enum ReplayMode {
+        // Poses come in at the rate they were recorded
+        ReplayRealtime,
+        // Every update() steps the trace forward by a fixed interval, so
+        // every run sees the same poses for the same frames no matter how
+        // fast it renders.
+        ReplayFast
+    };
+
+    // Replaces the device with a recorded trace, looping at the end.
+    // fastStep is how far each update() advances in ReplayFast.
+    bool startReplay(const QString &path, ReplayMode mode, qint64 fastStep = 1000000000 / 90);
+
+    // Writes every pose we get (from the device or a replay) to path
+    bool startRecording(const QString &path);
+    void stopRecording();
+
 private:
-    ohmd_context *m_ohmdContext;
-    ohmd_device *m_ohmdDevice;
+    friend class PoseThread;
+    void poseLoop();
+    void pollLoop();
+    void replayLoop();
+    void stopPoseThread();
+    void startPoseThread();
+
+    // Called by whoever produces poses, fills in the derived state and
+    // publishes it
+    void publishPose(qint64 timestamp, const QQuaternion &orientation, const QMatrix4x4 modelView[2]);
+
+    // Picks the trace record for replay time, and keeps the timestamps
+    // increasing when the trace loops
+    void publishReplayPose(qint64 replayTime, qint64 timestamp);
+
+    void writeTrace();
+
+    void finishInit(bool ok);
+
+    QByteArray m_product;
+    QMutex m_initMutex;
+    QWaitCondition m_initDone;
+    bool m_initialized = false;
+    bool m_initOk = false;
+
+    ohmd_context *m_ohmdContext = nullptr;
+    ohmd_device *m_ohmdDevice = nullptr;
+
+    QThread *m_poseThread = nullptr;
+    TripleBuffer<PoseSnapshot> m_poses;
+
+    // Only used by the pose producer (the pose thread, or the render thread
+    // when replaying in ReplayFast)
+    PoseHistory m_history;
+
+    PoseTrace m_replay;
+    ReplayMode m_replayMode = ReplayRealtime;
+    bool m_replaying = false;
+    int m_replayIndex = 0;
+    qint64 m_replayTime = 0;
+    qint64 m_replayStep = 0;
+
+    // Poses are queued by the producer and written to disk from a timer, so
+    // the pose thread never blocks on the file.
+    SpscRing<PoseTraceRecord, 4096> m_traceQueue;
+    std::atomic_bool m_recording{false};
+    PoseTraceWriter m_traceWriter;
+    QTimer m_traceTimer;
+
+    // Only used by the render thread
+    PosePredictor m_predictor;
+
+    // These are constant for a device, so only fetched and inverted once
+    QMatrix4x4 m_projection[2];
 };
 
 #endif // OHMDHANDLER_H
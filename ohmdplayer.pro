@@ -1,20 +1,18 @@
-QT       += core gui widgets
-INCLUDEPATH += /usr/include/openhmd
+QT       += core gui widgets network
 
-CONFIG += c++11
-
-DEFINES += QT_DEPRECATED_WARNINGS
-
-LIBS += -lopenhmd -lmpv
+include(common.pri)
 
 SOURCES += \
     main.cpp \
-    ohmdhandler.cpp \
+    mirrorwindow.cpp \
+    mpveventpump.cpp \
+    telemetryserver.cpp \
+    thumbnailindex.cpp \
     widget.cpp
 
 HEADERS += \
-    ohmdhandler.h \
+    mirrorwindow.h \
+    mpveventpump.h \
+    telemetryserver.h \
+    thumbnailindex.h \
     widget.h
-
-RESOURCES += \
-    shaders.qrc
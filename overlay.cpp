@@ -0,0 +1,85 @@
+#include "overlay.h"
+
+#include "shadercache.h"
+
+#include <QOpenGLShaderProgram>
+
+Overlay::~Overlay()
+{
+    delete m_shader;
+}
+
+void Overlay::initializeGL(ShaderCache *shaderCache)
+{
+    initializeOpenGLFunctions();
+
+    m_shader = new QOpenGLShaderProgram;
+    shaderCache->link(m_shader, ShaderCache::readSource(":/shader/overlay.vert"),
+                      ShaderCache::readSource(":/shader/overlay.frag"));
+    m_shader->bind();
+    m_shader->setUniformValue("tex_uni", 0);
+    m_shader->release();
+
+    // Core profile wants something bound even without attributes
+    m_vao.create();
+
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void Overlay::releaseGL()
+{
+    if (m_texture) {
+        glDeleteTextures(1, &m_texture);
+        m_texture = 0;
+    }
+    m_vao.destroy();
+    delete m_shader;
+    m_shader = nullptr;
+    m_size = QSize();
+}
+
+void Overlay::setImage(const QImage &image)
+{
+    if (!m_texture) {
+        return;
+    }
+
+    const QImage converted = image.convertToFormat(QImage::Format_RGBA8888_Premultiplied);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    if (converted.size() == m_size) {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, converted.width(), converted.height(), GL_RGBA, GL_UNSIGNED_BYTE, converted.constBits());
+    } else {
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, converted.width(), converted.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, converted.constBits());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    m_size = converted.size();
+}
+
+void Overlay::render(const QRectF &rect)
+{
+    if (isEmpty()) {
+        return;
+    }
+
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    m_shader->bind();
+    m_shader->setUniformValue("rect_uni", QVector4D(rect.left(), rect.top(), rect.right(), rect.bottom()));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+
+    m_vao.bind();
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    m_vao.release();
+
+    m_shader->release();
+    glDisable(GL_BLEND);
+}
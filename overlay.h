@@ -0,0 +1,37 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLVertexArrayObject>
+#include <QImage>
+
+class QOpenGLShaderProgram;
+class ShaderCache;
+
+// A textured quad drawn on top of the eyes, for things like the timing HUD
+class Overlay : protected QOpenGLExtraFunctions
+{
+public:
+    ~Overlay();
+
+    // With the context current
+    void initializeGL(ShaderCache *shaderCache);
+    void releaseGL();
+
+    // Uploads the image, needs the context current
+    void setImage(const QImage &image);
+    QSize size() const { return m_size; }
+    bool isEmpty() const { return m_size.isEmpty(); }
+
+    // Rectangle in normalized device coordinates of the current viewport,
+    // topLeft() being the lower left corner
+    void render(const QRectF &rect);
+
+private:
+    QOpenGLShaderProgram *m_shader = nullptr;
+    QOpenGLVertexArrayObject m_vao;
+    GLuint m_texture = 0;
+    QSize m_size;
+};
+
+#endif // OVERLAY_H
@@ -0,0 +1,144 @@
+#include "posepredictor.h"
+
+#include <QtMath>
+
+// Angle between two orientations, in degrees
+static float angleBetween(const QQuaternion &a, const QQuaternion &b)
+{
+    const float dot = qAbs(QQuaternion::dotProduct(a.normalized(), b.normalized()));
+    return qRadiansToDegrees(2.f * std::acos(qMin(dot, 1.f)));
+}
+
+void PoseHistory::add(qint64 timestamp, const QQuaternion &orientation)
+{
+    m_head = (m_head + 1) % Size;
+    m_orientations[m_head] = orientation;
+    m_timestamps[m_head] = timestamp;
+    m_count = qMin(m_count + 1, int(Size));
+}
+
+QVector3D PoseHistory::angularVelocity(qint64 windowNs) const
+{
+    if (m_count < 2) {
+        return QVector3D();
+    }
+
+    const qint64 newest = timestamp(0);
+    int oldest = 1;
+    while (oldest + 1 < m_count && newest - timestamp(oldest) < windowNs) {
+        oldest++;
+    }
+
+    const qint64 dt = newest - timestamp(oldest);
+    if (dt <= 0) {
+        return QVector3D();
+    }
+
+    QQuaternion delta = orientation(0) * orientation(oldest).conjugated();
+    if (delta.scalar() < 0) {
+        delta = -delta;
+    }
+
+    QVector3D axis;
+    float angle;
+    delta.getAxisAndAngle(&axis, &angle);
+    if (qFuzzyIsNull(angle)) {
+        return QVector3D();
+    }
+
+    return axis * qDegreesToRadians(angle) / (dt / 1e9f);
+}
+
+bool PoseHistory::orientationAt(qint64 time, QQuaternion *result) const
+{
+    if (m_count == 0 || time > timestamp(0) || time < timestamp(m_count - 1)) {
+        return false;
+    }
+
+    for (int age = 0; age < m_count - 1; age++) {
+        const qint64 newer = timestamp(age);
+        const qint64 older = timestamp(age + 1);
+        if (time < older) {
+            continue;
+        }
+        const float t = newer > older ? float(time - older) / float(newer - older) : 0.f;
+        *result = QQuaternion::slerp(orientation(age + 1), orientation(age), t);
+        return true;
+    }
+
+    *result = orientation(m_count - 1);
+    return true;
+}
+
+QQuaternion PosePredictor::predict(const QQuaternion &orientation, const QVector3D &angularVelocity, qint64 dt)
+{
+    const float speed = angularVelocity.length();
+    if (dt <= 0 || qFuzzyIsNull(speed)) {
+        return orientation;
+    }
+
+    const float angle = speed * (dt / 1e9f);
+    return QQuaternion::fromAxisAndAngle(angularVelocity / speed, qRadiansToDegrees(angle)) * orientation;
+}
+
+void PosePredictor::addPrediction(qint64 targetTime, const QQuaternion &predicted, const QQuaternion &unpredicted)
+{
+    // If nothing got evaluated for a while just drop the oldest
+    if (m_pendingCount == MaxPending) {
+        for (int i = 1; i < MaxPending; i++) {
+            m_pending[i - 1] = m_pending[i];
+        }
+        m_pendingCount--;
+    }
+
+    Prediction &prediction = m_pending[m_pendingCount++];
+    prediction.targetTime = targetTime;
+    prediction.predicted = predicted;
+    prediction.unpredicted = unpredicted;
+}
+
+void PosePredictor::evaluate(const PoseHistory &history)
+{
+    int resolved = 0;
+    for (; resolved < m_pendingCount; resolved++) {
+        const Prediction &prediction = m_pending[resolved];
+
+        QQuaternion actual;
+        if (!history.orientationAt(prediction.targetTime, &actual)) {
+            // Fell out of the history before we got to look at it
+            if (!history.isEmpty() && prediction.targetTime < history.oldestTimestamp()) {
+                continue;
+            }
+            break;
+        }
+
+        const float error = angleBetween(prediction.predicted, actual);
+        m_errorSum += error;
+        m_unpredictedErrorSum += angleBetween(prediction.unpredicted, actual);
+        m_maxError = qMax(m_maxError, error);
+        m_count++;
+    }
+
+    for (int i = resolved; i < m_pendingCount; i++) {
+        m_pending[i - resolved] = m_pending[i];
+    }
+    m_pendingCount -= resolved;
+}
+
+PosePredictor::Stats PosePredictor::takeStats()
+{
+    Stats stats;
+    stats.count = m_count;
+    if (m_count > 0) {
+        stats.meanError = m_errorSum / m_count;
+        stats.meanUnpredictedError = m_unpredictedErrorSum / m_count;
+        stats.maxError = m_maxError;
+    }
+
+    m_count = 0;
+    m_errorSum = 0;
+    m_unpredictedErrorSum = 0;
+    m_maxError = 0;
+
+    return stats;
+}
@@ -0,0 +1,83 @@
+#ifndef POSEPREDICTOR_H
+#define POSEPREDICTOR_H
+
+#include <QQuaternion>
+#include <QVector3D>
+
+// Short history of timestamped head orientations, filled by the pose thread
+// and shipped along with each pose snapshot.
+class PoseHistory
+{
+public:
+    enum {
+        Size = 64
+    };
+
+    void add(qint64 timestamp, const QQuaternion &orientation);
+
+    // Angular velocity in rad/s (axis * speed), estimated over the last
+    // windowNs of samples
+    QVector3D angularVelocity(qint64 windowNs = 20000000) const;
+
+    // Interpolated orientation at the given time, returns false if the time
+    // isn't covered by the history
+    bool orientationAt(qint64 timestamp, QQuaternion *orientation) const;
+
+    bool isEmpty() const { return m_count == 0; }
+    qint64 newestTimestamp() const { return timestamp(0); }
+    qint64 oldestTimestamp() const { return timestamp(m_count - 1); }
+    const QQuaternion &newestOrientation() const { return orientation(0); }
+
+private:
+    const QQuaternion &orientation(int age) const { return m_orientations[(m_head - age + Size) % Size]; }
+    qint64 timestamp(int age) const { return m_timestamps[(m_head - age + Size) % Size]; }
+
+    QQuaternion m_orientations[Size];
+    qint64 m_timestamps[Size]{};
+    int m_head = Size - 1;
+    int m_count = 0;
+};
+
+// Extrapolates orientation to the expected photon time on the render thread,
+// and keeps track of how far off those predictions were once the actual pose
+// for that time has arrived.
+class PosePredictor
+{
+public:
+    struct Stats {
+        int count = 0;
+        float meanError = 0; // degrees
+        float maxError = 0;
+        float meanUnpredictedError = 0; // what the error would have been without prediction
+    };
+
+    static QQuaternion predict(const QQuaternion &orientation, const QVector3D &angularVelocity, qint64 dt);
+
+    void addPrediction(qint64 targetTime, const QQuaternion &predicted, const QQuaternion &unpredicted);
+
+    // Resolves pending predictions that are now covered by the history
+    void evaluate(const PoseHistory &history);
+
+    // Returns the stats since the last call, and resets them
+    Stats takeStats();
+
+private:
+    struct Prediction {
+        qint64 targetTime = 0;
+        QQuaternion predicted;
+        QQuaternion unpredicted;
+    };
+    enum {
+        MaxPending = 16
+    };
+
+    Prediction m_pending[MaxPending];
+    int m_pendingCount = 0;
+
+    int m_count = 0;
+    double m_errorSum = 0;
+    double m_unpredictedErrorSum = 0;
+    float m_maxError = 0;
+};
+
+#endif // POSEPREDICTOR_H
@@ -0,0 +1,126 @@
+#include "posetrace.h"
+
+#include <QDebug>
+
+static const char s_magic[] = "OHMDPOSE";
+static const quint32 s_version = 1;
+
+static void writeMatrix(QDataStream &stream, const QMatrix4x4 &matrix)
+{
+    const float *data = matrix.constData();
+    for (int i = 0; i < 16; i++) {
+        stream << data[i];
+    }
+}
+
+static QMatrix4x4 readMatrix(QDataStream &stream)
+{
+    QMatrix4x4 matrix;
+    float *data = matrix.data();
+    for (int i = 0; i < 16; i++) {
+        stream >> data[i];
+    }
+    matrix.optimize();
+    return matrix;
+}
+
+static void setupStream(QDataStream &stream)
+{
+    stream.setByteOrder(QDataStream::LittleEndian);
+    stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+bool PoseTrace::load(const QString &path)
+{
+    m_records.clear();
+
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open pose trace" << path << file.errorString();
+        return false;
+    }
+    if (file.read(sizeof(s_magic) - 1) != QByteArray(s_magic)) {
+        qWarning() << path << "is not a pose trace";
+        return false;
+    }
+
+    QDataStream stream(&file);
+    setupStream(stream);
+
+    quint32 version = 0;
+    stream >> version;
+    if (version != s_version) {
+        qWarning() << "Unsupported pose trace version" << version;
+        return false;
+    }
+    projection[0] = readMatrix(stream);
+    projection[1] = readMatrix(stream);
+
+    while (!stream.atEnd()) {
+        PoseTraceRecord record;
+        float scalar, x, y, z;
+        stream >> record.timestamp >> scalar >> x >> y >> z;
+        record.orientation = QQuaternion(scalar, x, y, z);
+        record.modelView[0] = readMatrix(stream);
+        record.modelView[1] = readMatrix(stream);
+        if (stream.status() != QDataStream::Ok) {
+            // Probably cut off while recording, keep what we have
+            qWarning() << "Truncated pose trace" << path;
+            break;
+        }
+        m_records.append(record);
+    }
+
+    qDebug() << "loaded" << m_records.count() << "poses," << duration() / 1e9 << "seconds from" << path;
+    return !m_records.isEmpty();
+}
+
+int PoseTrace::indexAt(qint64 time, int hint) const
+{
+    int index = qBound(0, hint, m_records.count() - 1);
+    if (m_records[index].timestamp > time) {
+        index = 0;
+    }
+    while (index + 1 < m_records.count() && m_records[index + 1].timestamp <= time) {
+        index++;
+    }
+    return index;
+}
+
+bool PoseTraceWriter::open(const QString &path, const QMatrix4x4 projection[2])
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Failed to open" << path << m_file.errorString();
+        return false;
+    }
+    m_file.write(s_magic, sizeof(s_magic) - 1);
+
+    m_stream.setDevice(&m_file);
+    setupStream(m_stream);
+    m_stream << s_version;
+    writeMatrix(m_stream, projection[0]);
+    writeMatrix(m_stream, projection[1]);
+
+    m_firstTimestamp = -1;
+    return true;
+}
+
+void PoseTraceWriter::close()
+{
+    m_stream.setDevice(nullptr);
+    m_file.close();
+}
+
+void PoseTraceWriter::write(const PoseTraceRecord &record)
+{
+    if (m_firstTimestamp < 0) {
+        m_firstTimestamp = record.timestamp;
+    }
+
+    m_stream << qint64(record.timestamp - m_firstTimestamp)
+             << record.orientation.scalar() << record.orientation.x()
+             << record.orientation.y() << record.orientation.z();
+    writeMatrix(m_stream, record.modelView[0]);
+    writeMatrix(m_stream, record.modelView[1]);
+}
@@ -0,0 +1,60 @@
+#ifndef POSETRACE_H
+#define POSETRACE_H
+
+#include <QFile>
+#include <QDataStream>
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QVector>
+
+// Recorded head motion, so runs can be compared with identical viewports.
+//
+// The file is little endian, with single precision floats:
+//   "OHMDPOSE", quint32 version, 2 projection matrices (16 floats each)
+// followed by records until the end of the file:
+//   qint64 timestamp in ns relative to the first record, orientation
+//   (scalar, x, y, z), 2 modelview matrices (16 floats each)
+struct PoseTraceRecord
+{
+    qint64 timestamp = 0;
+    QQuaternion orientation;
+    QMatrix4x4 modelView[2];
+};
+
+class PoseTrace
+{
+public:
+    bool load(const QString &path);
+
+    bool isEmpty() const { return m_records.isEmpty(); }
+    int count() const { return m_records.count(); }
+    const PoseTraceRecord &record(int index) const { return m_records[index]; }
+
+    // Time from the first to the last record
+    qint64 duration() const { return isEmpty() ? 0 : m_records.last().timestamp; }
+
+    // The last record at or before time, searching forward from hint
+    int indexAt(qint64 time, int hint = 0) const;
+
+    QMatrix4x4 projection[2];
+
+private:
+    QVector<PoseTraceRecord> m_records;
+};
+
+class PoseTraceWriter
+{
+public:
+    bool open(const QString &path, const QMatrix4x4 projection[2]);
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    void write(const PoseTraceRecord &record);
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    qint64 m_firstTimestamp = -1;
+};
+
+#endif // POSETRACE_H
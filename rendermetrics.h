@@ -0,0 +1,72 @@
+#ifndef RENDERMETRICS_H
+#define RENDERMETRICS_H
+
+#include <QtGlobal>
+#include <atomic>
+
+// Durations in fixed buckets, for monitoring. add() is wait-free, readers
+// see each bucket up to date but not necessarily all of them at the same
+// instant.
+class DurationHistogram
+{
+public:
+    // Upper bounds of the buckets in ns, the last bucket takes the rest
+    enum { BoundCount = 12 };
+    static qint64 bound(int index)
+    {
+        static const qint64 bounds[BoundCount] = {
+            2000000, 4000000, 6000000, 8000000, 11100000, 13900000,
+            16700000, 20000000, 25000000, 33400000, 50000000, 100000000
+        };
+        return bounds[index];
+    }
+
+    void add(qint64 ns)
+    {
+        int index = 0;
+        while (index < BoundCount && ns > bound(index)) {
+            index++;
+        }
+        m_buckets[index].fetch_add(1, std::memory_order_relaxed);
+        m_sumNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    // Not cumulative, BoundCount is the overflow bucket
+    quint64 bucket(int index) const { return m_buckets[index].load(std::memory_order_relaxed); }
+    qint64 sumNs() const { return m_sumNs.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<quint64> m_buckets[BoundCount + 1]{};
+    std::atomic<qint64> m_sumNs{0};
+};
+
+// What the render and video threads publish for monitoring. Only relaxed
+// atomic stores on their side, so reading it from another thread never
+// holds them up.
+struct RenderMetrics
+{
+    // Compositor frames with a new video frame, and ones that reprojected
+    // the previous one (see VrRenderer::FrameCounters)
+    std::atomic<quint64> freshFrames{0};
+    std::atomic<quint64> reprojectedFrames{0};
+    std::atomic<quint64> droppedFrames{0};
+    std::atomic<quint64> lateFrames{0};
+
+    // Frames mpv rendered on the video thread
+    std::atomic<quint64> videoFrames{0};
+
+    // Between the starts of consecutive compositor frames, and the GPU time
+    // of everything (mpv included) per compositor frame
+    DurationHistogram frameInterval;
+    DurationHistogram gpuTime;
+
+    // How old the head pose was when the last frame sampled it
+    std::atomic<qint64> poseAgeNs{0};
+
+    // Render targets we keep allocated
+    std::atomic<qint64> videoBufferBytes{0};
+    std::atomic<qint64> eyeBufferBytes{0};
+    std::atomic<qint64> mirrorBufferBytes{0};
+};
+
+#endif // RENDERMETRICS_H
@@ -0,0 +1,63 @@
+#include "resolutionscaler.h"
+
+// Video first, mpv's scaling is usually what is expensive
+static const ResolutionScaler::Level s_levels[] = {
+    { 1.0f, 1.0f },
+    { 0.85f, 1.0f },
+    { 0.7f, 1.0f },
+    { 0.7f, 0.85f },
+    { 0.6f, 0.75f },
+    { 0.5f, 0.65f },
+};
+
+const ResolutionScaler::Level *ResolutionScaler::levels()
+{
+    return s_levels;
+}
+
+int ResolutionScaler::levelCount()
+{
+    return sizeof(s_levels) / sizeof(s_levels[0]);
+}
+
+bool ResolutionScaler::addFrame(qint64 gpuNs, qint64 budgetNs)
+{
+    if (budgetNs <= 0) {
+        return false;
+    }
+
+    // Exponential moving average, roughly over the last 10 frames
+    m_averageNs = m_averageNs == 0 ? gpuNs : m_averageNs + (gpuNs - m_averageNs) / 10;
+
+    if (m_cooldown > 0) {
+        m_cooldown--;
+        return false;
+    }
+
+    if (m_averageNs > budgetNs * 9 / 10) {
+        m_overBudgetFrames++;
+        m_underBudgetFrames = 0;
+    } else if (m_averageNs < budgetNs * 6 / 10) {
+        m_underBudgetFrames++;
+        m_overBudgetFrames = 0;
+    } else {
+        m_overBudgetFrames = 0;
+        m_underBudgetFrames = 0;
+    }
+
+    // React quickly when we're dropping frames, but be slow to go back up
+    if (m_overBudgetFrames >= 5 && m_level + 1 < levelCount()) {
+        m_level++;
+        m_decreases++;
+    } else if (m_underBudgetFrames >= 120 && m_level > 0) {
+        m_level--;
+        m_increases++;
+    } else {
+        return false;
+    }
+
+    m_overBudgetFrames = 0;
+    m_underBudgetFrames = 0;
+    m_cooldown = 30;
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef RESOLUTIONSCALER_H
+#define RESOLUTIONSCALER_H
+
+#include <QtGlobal>
+
+// Lowers the video and eye buffer resolution in steps when the GPU time per
+// frame gets close to the refresh interval, and raises it again once there's
+// plenty of headroom. The thresholds are far apart, and every change is
+// followed by a cooldown, so it settles instead of going back and forth.
+class ResolutionScaler
+{
+public:
+    struct Level {
+        float video;
+        float eyes;
+    };
+
+    // Feed the GPU time spent on one presented frame, and the time the
+    // frame has (0 disables scaling). Returns true if the level changed.
+    bool addFrame(qint64 gpuNs, qint64 budgetNs);
+
+    int level() const { return m_level; }
+    float videoScale() const { return levels()[m_level].video; }
+    float eyeScale() const { return levels()[m_level].eyes; }
+
+    // How often it had to step down or back up, since the start
+    int decreases() const { return m_decreases; }
+    int increases() const { return m_increases; }
+
+    // Smoothed GPU time per frame
+    qint64 averageGpuNs() const { return m_averageNs; }
+
+private:
+    static const Level *levels();
+    static int levelCount();
+
+    int m_level = 0;
+    qint64 m_averageNs = 0;
+    int m_overBudgetFrames = 0;
+    int m_underBudgetFrames = 0;
+    int m_cooldown = 0;
+
+    int m_decreases = 0;
+    int m_increases = 0;
+};
+
+#endif // RESOLUTIONSCALER_H
@@ -0,0 +1,33 @@
+#version 330
+
+// Both eyes side by side
+uniform sampler2D eye_tex_uni;
+
+// The part of the texture the eyes were rendered to
+uniform vec2 eye_scale_uni;
+
+in vec2 uv_red_var;
+in vec2 uv_green_var;
+in vec2 uv_blue_var;
+flat in float eye_offset_var;
+
+out vec4 color_out;
+
+// Keep each eye from bleeding into the other
+vec2 eye_buffer_uv(vec2 uv)
+{
+    return vec2(eye_offset_var + clamp(uv.x, 0.0, 1.0) * 0.5, uv.y) * eye_scale_uni;
+}
+
+void main(void)
+{
+    if (any(lessThan(uv_green_var, vec2(0.0))) || any(greaterThan(uv_green_var, vec2(1.0)))) {
+        color_out = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    color_out = vec4(texture(eye_tex_uni, eye_buffer_uv(uv_red_var)).r,
+                     texture(eye_tex_uni, eye_buffer_uv(uv_green_var)).g,
+                     texture(eye_tex_uni, eye_buffer_uv(uv_blue_var)).b,
+                     1.0);
+}
@@ -0,0 +1,21 @@
+#version 330
+
+layout(location = 0) in vec2 position_attr;
+layout(location = 1) in vec2 uv_red_attr;
+layout(location = 2) in vec2 uv_green_attr;
+layout(location = 3) in vec2 uv_blue_attr;
+layout(location = 4) in float eye_offset_attr;
+
+out vec2 uv_red_var;
+out vec2 uv_green_var;
+out vec2 uv_blue_var;
+flat out float eye_offset_var;
+
+void main(void)
+{
+    uv_red_var = uv_red_attr;
+    uv_green_var = uv_green_attr;
+    uv_blue_var = uv_blue_attr;
+    eye_offset_var = eye_offset_attr;
+    gl_Position = vec4(position_attr, 0.0, 1.0);
+}
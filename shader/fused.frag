@@ -0,0 +1,69 @@
+#version 330
+
+// Renders the eyes and corrects for the lenses in one go, without an eye
+// buffer in between. See DistortionLookup.
+
+uniform sampler2D tex_uni;
+
+// Both eyes side by side, where the green channel of each display pixel
+// ends up on the eye's image plane at z = -1
+uniform sampler2D lookup_uni;
+
+// Indexed by eye, i.e. the half of the display
+uniform mat3 eye_to_video_uni[2];
+uniform vec4 min_max_uv_uni[2];
+uniform vec2 lens_center_uni[2];
+
+// Red and blue spread relative to green
+uniform vec2 aberration_uni;
+
+// Edges of the image plane of an eye
+uniform vec2 tan_half_fov_uni;
+
+in vec2 lookup_uv_var;
+flat in int eye_var;
+
+out vec4 color_out;
+
+vec4 videoSample(vec2 position, vec2 position_dx, vec2 position_dy)
+{
+    mat3 rotation = eye_to_video_uni[eye_var];
+    vec3 d = rotation * vec3(position, -1.0);
+    int face = projectionFace(d);
+    vec2 uv = projectionUv(face, d);
+
+    // Outside of a 180 degree video
+    if (uv.x < 0.0 || uv.x > 1.0) {
+        return vec4(0.0);
+    }
+
+    vec4 rect = min_max_uv_uni[eye_var];
+    vec2 uv_size = rect.zw - rect.xy;
+    vec2 uv_dx = projectionDelta(uv, projectionUv(face, rotation * vec3(position + position_dx, -1.0))) * uv_size;
+    vec2 uv_dy = projectionDelta(uv, projectionUv(face, rotation * vec3(position + position_dy, -1.0))) * uv_size;
+    return textureGrad(tex_uni, mix(rect.xy, rect.zw, uv), uv_dx, uv_dy);
+}
+
+void main(void)
+{
+    vec2 green = texture(lookup_uni, lookup_uv_var).xy;
+    vec2 green_dx = dFdx(green);
+    vec2 green_dy = dFdy(green);
+
+    // Outside of what the eye buffer would have covered
+    if (any(greaterThan(abs(green), tan_half_fov_uni))) {
+        color_out = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    // The aberration scales around the lens centre, which stays a straight
+    // scale on the image plane
+    vec2 center = lens_center_uni[eye_var];
+    vec2 red = center + (green - center) * aberration_uni.x;
+    vec2 blue = center + (green - center) * aberration_uni.y;
+
+    color_out = vec4(videoSample(red, green_dx * aberration_uni.x, green_dy * aberration_uni.x).r,
+                     videoSample(green, green_dx, green_dy).g,
+                     videoSample(blue, green_dx * aberration_uni.y, green_dy * aberration_uni.y).b,
+                     1.0);
+}
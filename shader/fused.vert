@@ -0,0 +1,13 @@
+#version 330
+
+out vec2 lookup_uv_var;
+flat out int eye_var;
+
+void main(void)
+{
+    // One quad per eye, triangle strip without a vertex buffer
+    eye_var = gl_InstanceID;
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    lookup_uv_var = vec2((float(eye_var) + corner.x) * 0.5, corner.y);
+    gl_Position = vec4(float(eye_var) + corner.x - 1.0, corner.y * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,13 @@
+#version 330
+
+// Premultiplied alpha
+uniform sampler2D tex_uni;
+
+in vec2 uv_var;
+
+out vec4 color_out;
+
+void main(void)
+{
+    color_out = texture(tex_uni, uv_var);
+}
@@ -0,0 +1,14 @@
+#version 330
+
+// Where to put the quad, in normalized device coordinates
+uniform vec4 rect_uni;
+
+out vec2 uv_var;
+
+void main(void)
+{
+    // Triangle strip, no vertex buffer needed
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    uv_var = vec2(corner.x, 1.0 - corner.y);
+    gl_Position = vec4(mix(rect_uni.xy, rect_uni.zw, corner), 0.0, 1.0);
+}
@@ -0,0 +1,105 @@
+// Maps directions in video space (-z is the centre of the video, y up) to
+// per eye video coordinates, [0, 1] with v down. Gets pasted in after the
+// defines, see shaderSource().
+//
+// The face is looked up separately so the derivatives can be taken from
+// neighbouring directions mapped onto the same face.
+
+#if defined(EAC_PROJECTION) || defined(CUBEMAP_PROJECTION)
+#define CUBE_FACES
+
+const int FRONT = 0;
+const int RIGHT = 1;
+const int BACK = 2;
+const int LEFT = 3;
+const int UP = 4;
+const int DOWN = 5;
+
+// Cell of each face in the 3x2 grid, and how many quarter turns clockwise
+// it is stored rotated by
+#ifdef EAC_PROJECTION
+// YouTube's layout, left, front and right on top, and the back half below
+// turned on its side: bottom, back, top
+const ivec2 face_cell[6] = ivec2[6](ivec2(1, 0), ivec2(2, 0), ivec2(1, 1), ivec2(0, 0), ivec2(2, 1), ivec2(0, 1));
+const int face_turns[6] = int[6](0, 0, 1, 0, 3, 3);
+#else
+// Right, left, top and bottom, front, back, all upright
+const ivec2 face_cell[6] = ivec2[6](ivec2(1, 1), ivec2(0, 0), ivec2(2, 1), ivec2(1, 0), ivec2(2, 0), ivec2(0, 1));
+const int face_turns[6] = int[6](0, 0, 0, 0, 0, 0);
+#endif
+
+int projectionFace(vec3 d)
+{
+    vec3 a = abs(d);
+    if (a.x >= a.y && a.x >= a.z) {
+        return d.x > 0.0 ? RIGHT : LEFT;
+    }
+    if (a.y >= a.z) {
+        return d.y > 0.0 ? UP : DOWN;
+    }
+    return d.z < 0.0 ? FRONT : BACK;
+}
+
+// Position on the face as seen from inside the cube, unfolded around the
+// front, x to the right and y down, [-1, 1]
+vec2 faceCoords(int face, vec3 d)
+{
+    if (face == FRONT) {
+        return vec2(d.x, -d.y) / -d.z;
+    } else if (face == RIGHT) {
+        return vec2(d.z, -d.y) / d.x;
+    } else if (face == BACK) {
+        return vec2(-d.x, -d.y) / d.z;
+    } else if (face == LEFT) {
+        return vec2(-d.z, -d.y) / -d.x;
+    } else if (face == UP) {
+        return vec2(d.x, -d.z) / d.y;
+    }
+    return vec2(d.x, d.z) / -d.y;
+}
+
+vec2 projectionUv(int face, vec3 d)
+{
+    vec2 st = faceCoords(face, d);
+#ifdef EAC_PROJECTION
+    // Equal angles get equal space on the face
+    st = atan(st) * (4.0 / 3.14159265);
+#endif
+    for (int i = 0; i < face_turns[face]; i++) {
+        st = vec2(-st.y, st.x);
+    }
+    return (vec2(face_cell[face]) + st * 0.5 + 0.5) / vec2(3.0, 2.0);
+}
+
+vec2 projectionDelta(vec2 uv, vec2 other)
+{
+    return other - uv;
+}
+
+#else
+
+// Horizontal coverage of the video, in radians
+uniform float video_angle_uni;
+
+int projectionFace(vec3 d)
+{
+    return 0;
+}
+
+vec2 projectionUv(int face, vec3 d)
+{
+    float longitude = atan(d.x, -d.z);
+    float latitude = asin(clamp(d.y / length(d), -1.0, 1.0));
+    return vec2(0.5 + longitude / video_angle_uni, 0.5 - latitude / 3.14159265);
+}
+
+// Without jumping across the seam behind the viewer
+vec2 projectionDelta(vec2 uv, vec2 other)
+{
+    float period = 6.28318531 / video_angle_uni;
+    vec2 delta = other - uv;
+    delta.x -= round(delta.x / period) * period;
+    return delta;
+}
+
+#endif
@@ -18,45 +18,30 @@
  *
  */
 
-#define M_PI 3.1415926535897932384626433832795
-
 uniform sampler2D tex_uni;
-uniform vec4 min_max_uv_uni;
-uniform float projection_angle_factor_uni;
-uniform float eye_offset;
 
-in vec3 position_var;
+#ifdef CUBE_FACES
+in vec3 direction_var;
+flat in vec4 uv_rect_var;
+#else
+in vec2 uv_var;
+#endif
 
 out vec4 color_out;
 
 void main(void)
 {
-    vec2 dir_h = position_var.xz;
-    float length_h = length(dir_h);
-    dir_h /= length_h;
-    vec2 dir_v = normalize(vec2(length_h, position_var.y));
-
-    vec2 sphere_coord = vec2(acos(dir_h.y), acos(dir_v.y)) * vec2(0.5 / M_PI, 1.0 / M_PI);
-    if(dir_h.x > 0.0)
-        sphere_coord.x = 1.0 - sphere_coord.x;
-
-    sphere_coord.x -= 0.5;
-    sphere_coord.x *= projection_angle_factor_uni;
-    sphere_coord.x += 0.5;
-
-// idk if this is right
-    sphere_coord.x += eye_offset;
-
-    vec3 color;
-
-    if(sphere_coord.x < 0.0 || sphere_coord.x > 1.0)
-    {
-        color = vec3(0.0);
-    }
-    else
-    {
-        vec2 uv = min_max_uv_uni.xy + (min_max_uv_uni.zw - min_max_uv_uni.xy) * sphere_coord;
-        color = texture(tex_uni, uv).rgb;
-    }
-    color_out = vec4(color, 1.0);
+#ifdef CUBE_FACES
+    int face = projectionFace(direction_var);
+    vec2 uv = projectionUv(face, direction_var);
+
+    // Take the derivatives on the same face, otherwise the jump to the
+    // neighbouring cell selects the smallest mip level along the edges
+    vec2 uv_size = uv_rect_var.zw - uv_rect_var.xy;
+    vec2 uv_dx = projectionDelta(uv, projectionUv(face, direction_var + dFdx(direction_var))) * uv_size;
+    vec2 uv_dy = projectionDelta(uv, projectionUv(face, direction_var + dFdy(direction_var))) * uv_size;
+    color_out = vec4(textureGrad(tex_uni, mix(uv_rect_var.xy, uv_rect_var.zw, uv), uv_dx, uv_dy).rgb, 1.0);
+#else
+    color_out = vec4(texture(tex_uni, uv_var).rgb, 1.0);
+#endif
 }
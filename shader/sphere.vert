@@ -1,5 +1,17 @@
 #version 330
 
+#if defined(STEREO_VIEWPORT_ARB)
+#extension GL_ARB_shader_viewport_layer_array : require
+#define STEREO_VIEWPORT_INDEX
+#elif defined(STEREO_VIEWPORT_AMD)
+#extension GL_AMD_vertex_shader_viewport_index : require
+#define STEREO_VIEWPORT_INDEX
+#endif
+
+#if defined(EAC_PROJECTION) || defined(CUBEMAP_PROJECTION)
+#define CUBE_FACES
+#endif
+
 /*
  * Created by Florian Märkl <info@florianmaerkl.de>
  *
@@ -18,14 +30,43 @@
  *
  */
 
-uniform mat4 modelview_projection_uni;
+// Indexed by which half of the screen the eye is drawn to, i.e. the instance
+layout(std140) uniform EyeBlock
+{
+	mat4 modelview_projection_uni[2];
+	vec4 min_max_uv_uni[2];
+};
 
-in vec3 vertex_attr;
+layout(location = 0) in vec3 vertex_attr;
+layout(location = 1) in vec2 uv_attr;
 
-out vec3 position_var;
+#ifdef CUBE_FACES
+// The face is picked per fragment, so pass on the direction instead
+out vec3 direction_var;
+flat out vec4 uv_rect_var;
+#else
+out vec2 uv_var;
+#endif
 
 void main(void)
 {
-	position_var = vertex_attr;
-	gl_Position = modelview_projection_uni * vec4(vertex_attr, 1.0);
-}
\ No newline at end of file
+	int eye = gl_InstanceID;
+
+#ifdef CUBE_FACES
+	direction_var = vertex_attr;
+	uv_rect_var = min_max_uv_uni[eye];
+#else
+	uv_var = mix(min_max_uv_uni[eye].xy, min_max_uv_uni[eye].zw, uv_attr);
+#endif
+	vec4 position = modelview_projection_uni[eye] * vec4(vertex_attr, 1.0);
+
+#ifdef STEREO_VIEWPORT_INDEX
+	gl_ViewportIndex = eye;
+#else
+	// Squash into our half of the screen, and clip away what spills over
+	position.x = position.x * 0.5 + (float(eye) - 0.5) * position.w;
+	gl_ClipDistance[0] = eye == 0 ? -position.x : position.x;
+#endif
+
+	gl_Position = position;
+}
@@ -0,0 +1,168 @@
+#include "shadercache.h"
+
+#include "steadyclock.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+#include <cstring>
+
+// Followed by the binary. Written in native byte order; a program binary
+// is only valid for the driver that produced it, so there is no point in
+// a portable layout.
+struct BinaryHeader
+{
+    char magic[8];
+    quint32 format;
+    quint32 size;
+};
+
+static const char s_magic[8] = {'O', 'H', 'M', 'D', 'P', 'R', 'O', 'G'};
+
+void ShaderCache::initializeGL()
+{
+    initializeOpenGLFunctions();
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    GLint formats = 0;
+    if (context->format().version() >= qMakePair(4, 1) || context->hasExtension("GL_ARB_get_program_binary")) {
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    m_supported = formats > 0;
+    if (!m_supported) {
+        qDebug() << "driver can't save program binaries, compiling shaders every time";
+    }
+
+    // Binaries are only good for exactly the same driver, and Qt adds its
+    // own bits to the sources
+    m_driver = QByteArray(reinterpret_cast<const char *>(glGetString(GL_VENDOR))) + '\n' +
+            reinterpret_cast<const char *>(glGetString(GL_RENDERER)) + '\n' +
+            reinterpret_cast<const char *>(glGetString(GL_VERSION)) + '\n' +
+            QT_VERSION_STR;
+
+    m_hits = 0;
+    m_misses = 0;
+    m_linkNs = 0;
+}
+
+QString ShaderCache::directory()
+{
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/shaders";
+    QDir().mkpath(dir);
+    return dir;
+}
+
+QByteArray ShaderCache::readSource(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << path;
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+bool ShaderCache::link(QOpenGLShaderProgram *program, const QByteArray &vertexSource, const QByteArray &fragmentSource)
+{
+    const qint64 start = SteadyClock::nowNs();
+
+    QString path;
+    if (m_supported) {
+        QCryptographicHash hash(QCryptographicHash::Sha1);
+        hash.addData(m_driver);
+        hash.addData(QByteArray(1, '\0'));
+        hash.addData(vertexSource);
+        hash.addData(QByteArray(1, '\0'));
+        hash.addData(fragmentSource);
+        path = directory() + "/" + hash.result().toHex() + ".bin";
+
+        if (load(program, path)) {
+            m_hits++;
+            m_linkNs += SteadyClock::nowNs() - start;
+            return true;
+        }
+    }
+
+    program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertexSource);
+    program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+    if (m_supported) {
+        glProgramParameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    const bool linked = program->link();
+    if (linked && m_supported) {
+        store(program, path);
+    }
+
+    m_misses++;
+    m_linkNs += SteadyClock::nowNs() - start;
+    return linked;
+}
+
+bool ShaderCache::load(QOpenGLShaderProgram *program, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    BinaryHeader header;
+    if (data.size() < int(sizeof(header))) {
+        return false;
+    }
+    memcpy(&header, data.constData(), sizeof(header));
+    if (memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || int(header.size) != data.size() - int(sizeof(header))) {
+        qWarning() << "Corrupt program binary" << path;
+        file.remove();
+        return false;
+    }
+
+    // Qt's link() takes a program that is already linked as is when it has
+    // no shaders of its own
+    program->create();
+    glProgramBinary(program->programId(), header.format, data.constData() + sizeof(header), header.size);
+    GLint status = GL_FALSE;
+    glGetProgramiv(program->programId(), GL_LINK_STATUS, &status);
+    if (status != GL_TRUE || !program->link()) {
+        // Usually a driver update that kept the version string
+        qDebug() << "Driver rejected program binary" << path;
+        file.remove();
+        return false;
+    }
+    return true;
+}
+
+void ShaderCache::store(QOpenGLShaderProgram *program, const QString &path)
+{
+    GLint length = 0;
+    glGetProgramiv(program->programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+
+    QByteArray data(int(sizeof(BinaryHeader)) + length, Qt::Uninitialized);
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program->programId(), length, &written, &format, data.data() + sizeof(BinaryHeader));
+    if (written <= 0) {
+        return;
+    }
+
+    BinaryHeader header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.format = format;
+    header.size = written;
+    memcpy(data.data(), &header, sizeof(header));
+    data.resize(int(sizeof(header)) + written);
+
+    // Written to a temporary file and renamed, so another instance never
+    // sees half a binary
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "Failed to write program binary" << path << file.errorString();
+    }
+}
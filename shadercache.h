@@ -0,0 +1,43 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <QOpenGLExtraFunctions>
+#include <QString>
+
+class QOpenGLShaderProgram;
+
+// Keeps linked programs on disk as driver binaries (GL_ARB_get_program_binary),
+// keyed by the driver and the shader sources, so they are only compiled the
+// first time. Needs the context current for everything.
+class ShaderCache : protected QOpenGLExtraFunctions
+{
+public:
+    void initializeGL();
+
+    // Links the program from the cached binary for these sources if there
+    // is one, otherwise compiles it and stores the binary
+    bool link(QOpenGLShaderProgram *program, const QByteArray &vertexSource, const QByteArray &fragmentSource);
+
+    // Since initializeGL()
+    int hits() const { return m_hits; }
+    int misses() const { return m_misses; }
+    qint64 linkNs() const { return m_linkNs; }
+
+    // Also where mpv keeps its shader cache
+    static QString directory();
+
+    static QByteArray readSource(const QString &path);
+
+private:
+    bool load(QOpenGLShaderProgram *program, const QString &path);
+    void store(QOpenGLShaderProgram *program, const QString &path);
+
+    bool m_supported = false;
+    QByteArray m_driver;
+
+    int m_hits = 0;
+    int m_misses = 0;
+    qint64 m_linkNs = 0;
+};
+
+#endif // SHADERCACHE_H
@@ -0,0 +1,62 @@
+#include "spheremesh.h"
+
+#include <QtMath>
+
+// How many quads wide each band of triangles is, so the previous row of
+// vertices is still in the post-transform cache when we get to the next.
+static const int s_bandWidth = 16;
+
+void SphereMesh::generate(float videoAngle)
+{
+    videoAngle = qBound(1.f, videoAngle, 360.f);
+
+    // Roughly the same tessellation density regardless of coverage
+    const int slices = qMax(8, qCeil(96 * videoAngle / 360.f));
+    const int stacks = 48;
+
+    vertices.clear();
+    vertices.reserve((slices + 1) * (stacks + 1));
+    for (int stack = 0; stack <= stacks; stack++) {
+        const float v = float(stack) / stacks;
+        const float latitude = qDegreesToRadians(90.f - 180.f * v);
+
+        for (int slice = 0; slice <= slices; slice++) {
+            const float u = float(slice) / slices;
+            const float longitude = qDegreesToRadians((u - 0.5f) * videoAngle);
+
+            // Straight ahead (-z) is the center of the video
+            SphereVertex vertex;
+            vertex.position[0] = std::sin(longitude) * std::cos(latitude);
+            vertex.position[1] = std::sin(latitude);
+            vertex.position[2] = -std::cos(longitude) * std::cos(latitude);
+            vertex.uv[0] = u;
+            vertex.uv[1] = v;
+            vertices.append(vertex);
+        }
+    }
+
+    indices.clear();
+    indices.reserve(slices * stacks * 6);
+    const int rowLength = slices + 1;
+    for (int bandStart = 0; bandStart < slices; bandStart += s_bandWidth) {
+        const int bandEnd = qMin(bandStart + s_bandWidth, slices);
+
+        for (int stack = 0; stack < stacks; stack++) {
+            for (int slice = bandStart; slice < bandEnd; slice++) {
+                const quint16 topLeft = stack * rowLength + slice;
+                const quint16 topRight = topLeft + 1;
+                const quint16 bottomLeft = topLeft + rowLength;
+                const quint16 bottomRight = bottomLeft + 1;
+
+                // The top and bottom rows collapse into the poles, skip the
+                // triangles that would be degenerate there
+                if (stack != 0) {
+                    indices << topLeft << bottomLeft << topRight;
+                }
+                if (stack != stacks - 1) {
+                    indices << topRight << bottomLeft << bottomRight;
+                }
+            }
+        }
+    }
+}
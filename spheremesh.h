@@ -0,0 +1,25 @@
+#ifndef SPHEREMESH_H
+#define SPHEREMESH_H
+
+#include <QVector>
+
+struct SphereVertex
+{
+    float position[3];
+
+    // Where in the (per eye) video frame this vertex is, [0, 1]
+    float uv[2];
+};
+
+// Indexed unit sphere that only covers the angular extent of the video, with
+// the equirectangular texture coordinates baked into the vertices.
+class SphereMesh
+{
+public:
+    void generate(float videoAngle);
+
+    QVector<SphereVertex> vertices;
+    QVector<quint16> indices;
+};
+
+#endif // SPHEREMESH_H
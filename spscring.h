@@ -0,0 +1,48 @@
+#ifndef SPSCRING_H
+#define SPSCRING_H
+
+#include <atomic>
+
+// Lock-free single producer, single consumer ring buffer.
+//
+// Unlike TripleBuffer nothing gets overwritten, push() just fails when the
+// consumer doesn't keep up.
+template<typename T, unsigned Size>
+class SpscRing
+{
+    static_assert((Size & (Size - 1)) == 0, "Size needs to be a power of two");
+
+public:
+    bool push(const T &value)
+    {
+        const unsigned head = m_head.load(std::memory_order_relaxed);
+        if (head - m_tail.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        m_items[head & (Size - 1)] = value;
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &value)
+    {
+        const unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if (tail == m_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        value = m_items[tail & (Size - 1)];
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T m_items[Size];
+
+    // Only written by the producer
+    alignas(64) std::atomic<unsigned> m_head{0};
+
+    // Only written by the consumer
+    alignas(64) std::atomic<unsigned> m_tail{0};
+};
+
+#endif // SPSCRING_H
@@ -0,0 +1,54 @@
+#ifndef STARTUPLOG_H
+#define STARTUPLOG_H
+
+#include "steadyclock.h"
+
+#include <atomic>
+#include <QDebug>
+#include <QThread>
+
+// Logs when each part of startup is done, relative to start(), until the
+// first video frame is on screen. Does nothing unless start() was called,
+// can be called from any thread.
+namespace StartupLog {
+
+inline std::atomic<qint64> &origin()
+{
+    static std::atomic<qint64> value{0};
+    return value;
+}
+
+inline void start()
+{
+    if (QThread::currentThread()->objectName().isEmpty()) {
+        QThread::currentThread()->setObjectName("main");
+    }
+    origin() = SteadyClock::nowNs();
+}
+
+inline void log(qint64 start, const char *phase)
+{
+    qDebug().nospace() << "startup: " << phase << " after " << (SteadyClock::nowNs() - start) / 1e6
+                       << " ms (" << QThread::currentThread()->objectName() << " thread)";
+}
+
+inline void mark(const char *phase)
+{
+    const qint64 start = origin();
+    if (start) {
+        log(start, phase);
+    }
+}
+
+// Logs the last phase and stops logging
+inline void finish(const char *phase)
+{
+    const qint64 start = origin().exchange(0);
+    if (start) {
+        log(start, phase);
+    }
+}
+
+} // namespace StartupLog
+
+#endif // STARTUPLOG_H
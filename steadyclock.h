@@ -0,0 +1,18 @@
+#ifndef STEADYCLOCK_H
+#define STEADYCLOCK_H
+
+#include <QtGlobal>
+#include <chrono>
+
+namespace SteadyClock {
+
+// Monotonic timestamp in nanoseconds, used for everything that needs to be
+// compared across threads (poses, frame timings etc.)
+inline qint64 nowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace SteadyClock
+
+#endif // STEADYCLOCK_H
@@ -0,0 +1,175 @@
+#include "telemetryserver.h"
+
+#include "rendermetrics.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QDebug>
+
+TelemetryServer::TelemetryServer(const QString &path, const RenderMetrics *metrics, mpv_handle *mpv, QObject *parent) :
+    QThread(parent),
+    m_path(path),
+    m_metrics(metrics),
+    m_mpv(mpv)
+{
+    setObjectName("TelemetryServer");
+}
+
+TelemetryServer::~TelemetryServer()
+{
+    stopServing();
+}
+
+void TelemetryServer::startServing()
+{
+    if (isRunning()) {
+        return;
+    }
+    start(QThread::LowPriority);
+}
+
+void TelemetryServer::stopServing()
+{
+    quit();
+    wait();
+}
+
+void TelemetryServer::run()
+{
+    // Left behind if we crashed last time
+    QLocalServer::removeServer(m_path);
+
+    QLocalServer server;
+    if (!server.listen(m_path)) {
+        qWarning() << "Failed to listen on" << m_path << server.errorString();
+        return;
+    }
+    connect(&server, &QLocalServer::newConnection, &server, [this, &server]() {
+        while (QLocalSocket *socket = server.nextPendingConnection()) {
+            serve(socket);
+        }
+    });
+    qDebug() << "serving metrics on" << m_path;
+
+    exec();
+
+    server.close();
+}
+
+void TelemetryServer::serve(QLocalSocket *socket)
+{
+    connect(socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater);
+
+    // Wait for the request line if it is HTTP, clients that don't send
+    // anything get the metrics after a moment
+    connect(socket, &QLocalSocket::readyRead, socket, [this, socket]() {
+        if (socket->canReadLine()) {
+            respond(socket);
+        }
+    });
+    QTimer::singleShot(200, socket, [this, socket]() { respond(socket); });
+}
+
+void TelemetryServer::respond(QLocalSocket *socket)
+{
+    if (socket->property("answered").toBool()) {
+        return;
+    }
+    socket->setProperty("answered", true);
+
+    const QByteArray body = metricsText();
+    if (socket->peek(4) == "GET ") {
+        socket->write("HTTP/1.0 200 OK\r\n"
+                      "Content-Type: text/plain; version=0.0.4\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "\r\n");
+    }
+    socket->write(body);
+    socket->disconnectFromServer();
+}
+
+static void addHeader(QByteArray &text, const char *name, const char *type, const char *help)
+{
+    text += QByteArray("# HELP ") + name + " " + help + "\n";
+    text += QByteArray("# TYPE ") + name + " " + type + "\n";
+}
+
+static void addValue(QByteArray &text, const char *name, const char *labels, double value)
+{
+    text += name;
+    if (labels) {
+        text += QByteArray("{") + labels + "}";
+    }
+    text += " " + QByteArray::number(value, 'g', 12) + "\n";
+}
+
+static void addHistogram(QByteArray &text, const char *name, const char *help, const DurationHistogram &histogram)
+{
+    addHeader(text, name, "histogram", help);
+    const QByteArray bucket = QByteArray(name) + "_bucket";
+    quint64 count = 0;
+    for (int i = 0; i < DurationHistogram::BoundCount; i++) {
+        count += histogram.bucket(i);
+        const QByteArray le = "le=\"" + QByteArray::number(DurationHistogram::bound(i) / 1e9, 'g', 6) + "\"";
+        addValue(text, bucket.constData(), le.constData(), count);
+    }
+    count += histogram.bucket(DurationHistogram::BoundCount);
+    addValue(text, bucket.constData(), "le=\"+Inf\"", count);
+    addValue(text, (QByteArray(name) + "_sum").constData(), nullptr, histogram.sumNs() / 1e9);
+    addValue(text, (QByteArray(name) + "_count").constData(), nullptr, count);
+}
+
+// Leaves the metric out if this mpv doesn't have the property (yet)
+static void addMpvProperty(QByteArray &text, mpv_handle *mpv, const char *property, const char *name,
+                           const char *type, const char *help)
+{
+    double value = 0;
+    if (mpv_get_property(mpv, property, MPV_FORMAT_DOUBLE, &value) < 0) {
+        return;
+    }
+    addHeader(text, name, type, help);
+    addValue(text, name, nullptr, value);
+}
+
+QByteArray TelemetryServer::metricsText() const
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    QByteArray text;
+
+    addHeader(text, "ohmd_frames_total", "counter", "Frames presented to the headset, with a new video frame or reprojecting the last one");
+    addValue(text, "ohmd_frames_total", "video=\"fresh\"", m_metrics->freshFrames.load(relaxed));
+    addValue(text, "ohmd_frames_total", "video=\"reprojected\"", m_metrics->reprojectedFrames.load(relaxed));
+
+    addHeader(text, "ohmd_video_frames_rendered_total", "counter", "Video frames mpv rendered on the video thread");
+    addValue(text, "ohmd_video_frames_rendered_total", nullptr, m_metrics->videoFrames.load(relaxed));
+    addHeader(text, "ohmd_video_frames_dropped_total", "counter", "Video frames rendered but replaced before they were shown");
+    addValue(text, "ohmd_video_frames_dropped_total", nullptr, m_metrics->droppedFrames.load(relaxed));
+    addHeader(text, "ohmd_video_frames_late_total", "counter", "Video frames shown after the refresh mpv meant them for");
+    addValue(text, "ohmd_video_frames_late_total", nullptr, m_metrics->lateFrames.load(relaxed));
+
+    addHistogram(text, "ohmd_frame_interval_seconds", "Time between the starts of consecutive headset frames",
+                 m_metrics->frameInterval);
+    addHistogram(text, "ohmd_frame_gpu_seconds", "GPU time per headset frame, mpv included", m_metrics->gpuTime);
+
+    addHeader(text, "ohmd_pose_age_seconds", "gauge", "Age of the head pose when the last frame sampled it");
+    addValue(text, "ohmd_pose_age_seconds", nullptr, m_metrics->poseAgeNs.load(relaxed) / 1e9);
+
+    addHeader(text, "ohmd_gpu_buffer_bytes", "gauge", "GPU memory held by our render targets");
+    addValue(text, "ohmd_gpu_buffer_bytes", "buffer=\"video\"", m_metrics->videoBufferBytes.load(relaxed));
+    addValue(text, "ohmd_gpu_buffer_bytes", "buffer=\"eyes\"", m_metrics->eyeBufferBytes.load(relaxed));
+    addValue(text, "ohmd_gpu_buffer_bytes", "buffer=\"mirror\"", m_metrics->mirrorBufferBytes.load(relaxed));
+
+    // mpv's client API is thread safe, this only waits for mpv's core, never
+    // for our render threads
+    addMpvProperty(text, m_mpv, "demuxer-cache-duration", "mpv_cache_seconds", "gauge", "Seconds of media buffered ahead");
+    addMpvProperty(text, m_mpv, "cache-buffering-state", "mpv_cache_buffering_percent", "gauge", "How full the cache is before playback resumes");
+    addMpvProperty(text, m_mpv, "decoder-frame-drop-count", "mpv_decoder_frames_dropped_total", "counter", "Frames the decoder dropped");
+    addMpvProperty(text, m_mpv, "frame-drop-count", "mpv_output_frames_dropped_total", "counter", "Frames mpv's video output dropped");
+    addMpvProperty(text, m_mpv, "mistimed-frame-count", "mpv_mistimed_frames_total", "counter", "Frames mistimed in display sync mode");
+    addMpvProperty(text, m_mpv, "time-pos", "mpv_position_seconds", "gauge", "Playback position");
+    addMpvProperty(text, m_mpv, "duration", "mpv_duration_seconds", "gauge", "Length of the current file");
+    addMpvProperty(text, m_mpv, "playlist-pos", "mpv_playlist_position", "gauge", "Index of the current playlist entry");
+
+    return text;
+}
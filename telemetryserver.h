@@ -0,0 +1,38 @@
+#ifndef TELEMETRYSERVER_H
+#define TELEMETRYSERVER_H
+
+#include <mpv/client.h>
+#include <QThread>
+
+class QLocalSocket;
+struct RenderMetrics;
+
+// Serves the render metrics and some of mpv's counters in Prometheus' text
+// format on a Unix domain socket, from its own thread. Answers plain HTTP
+// GETs (curl --unix-socket), and anything that just connects and reads.
+class TelemetryServer : public QThread
+{
+    Q_OBJECT
+
+public:
+    TelemetryServer(const QString &path, const RenderMetrics *metrics, mpv_handle *mpv, QObject *parent);
+    ~TelemetryServer();
+
+    void startServing();
+    // Before the mpv handle goes away
+    void stopServing();
+
+protected:
+    void run() override;
+
+private:
+    void serve(QLocalSocket *socket);
+    void respond(QLocalSocket *socket);
+    QByteArray metricsText() const;
+
+    const QString m_path;
+    const RenderMetrics *m_metrics;
+    mpv_handle *m_mpv;
+};
+
+#endif // TELEMETRYSERVER_H
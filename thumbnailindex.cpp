@@ -0,0 +1,337 @@
+#include "thumbnailindex.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QTemporaryFile>
+#include <QDebug>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+// Native byte order, it never leaves the machine. Followed by one valid flag
+// per slot, padded to a page, then the slots, Format_RGB32.
+struct ThumbnailIndex::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 width;
+    quint32 height;
+    quint32 count;
+    quint32 intervalMs;
+};
+
+static const char s_magic[8] = {'O', 'H', 'M', 'D', 'T', 'H', 'M', 'B'};
+static const quint32 s_version = 1;
+static const qint64 s_slotsOffset = 4096;
+static const qint64 s_slotSize = ThumbnailIndex::ThumbnailWidth * ThumbnailIndex::ThumbnailHeight * 4;
+
+ThumbnailIndex::ThumbnailIndex(QObject *parent) : QThread(parent)
+{
+    setObjectName("ThumbnailIndex");
+    static_assert(sizeof(Header) + MaxThumbnails <= s_slotsOffset, "valid flags don't fit in front of the slots");
+}
+
+ThumbnailIndex::~ThumbnailIndex()
+{
+    stop();
+}
+
+void ThumbnailIndex::index(const QByteArray &path)
+{
+    // The GUI thread also renders the headset, so the old file's mpv handle
+    // and mapping are left for the thread to drop on its own time
+    {
+        QMutexLocker locker(&m_mutex);
+        m_pendingPath = path;
+        m_pending = true;
+        m_wakeup.wakeAll();
+    }
+    if (!m_running.exchange(true)) {
+        start(QThread::LowestPriority);
+    }
+}
+
+void ThumbnailIndex::stop()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_running = false;
+        m_wakeup.wakeAll();
+    }
+    wait();
+}
+
+QImage ThumbnailIndex::thumbnail(double seconds) const
+{
+    QMutexLocker locker(&m_mutex);
+    // Don't show the previous file's thumbnails until the thread switched
+    if (!m_map || m_pending || seconds < 0) {
+        return QImage();
+    }
+
+    const uchar *valid = m_map + sizeof(Header);
+    for (int slot = qMin(int(seconds * 1000 / m_intervalMs), m_count - 1); slot >= 0; slot--) {
+        if (reinterpret_cast<const std::atomic<uchar> *>(valid + slot)->load(std::memory_order_acquire)) {
+            const uchar *pixels = m_map + s_slotsOffset + slot * s_slotSize;
+            return QImage(pixels, ThumbnailWidth, ThumbnailHeight, QImage::Format_RGB32).copy();
+        }
+    }
+    return QImage();
+}
+
+QString ThumbnailIndex::cachePath() const
+{
+    // Hashing all of an 8K video would take longer than indexing it, the
+    // size plus the first and last MB tell files apart well enough
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    QFile file(QString::fromUtf8(m_path));
+    if (file.open(QIODevice::ReadOnly)) {
+        const qint64 size = file.size();
+        hash.addData(reinterpret_cast<const char *>(&size), sizeof(size));
+        hash.addData(file.read(1 << 20));
+        if (size > 2 << 20) {
+            file.seek(size - (1 << 20));
+            hash.addData(file.read(1 << 20));
+        }
+    } else {
+        // Something only mpv can open, e.g. a URL
+        hash.addData(m_path);
+    }
+
+    const QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails";
+    QDir().mkpath(dir);
+    return dir + "/" + hash.result().toHex() + ".thumbs";
+}
+
+bool ThumbnailIndex::openCache(double duration)
+{
+    // Spread the slots out over long videos instead of growing the file
+    int intervalMs = qMax(int(MinIntervalMs), int(std::ceil(duration * 1000 / MaxThumbnails)));
+    int count = qMax(1, int(std::ceil(duration * 1000 / intervalMs)));
+
+    Header header;
+    memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = s_version;
+    header.width = ThumbnailWidth;
+    header.height = ThumbnailHeight;
+    header.count = count;
+    header.intervalMs = intervalMs;
+    const qint64 size = s_slotsOffset + count * s_slotSize;
+
+    m_cacheFile.setFileName(cachePath());
+    Header existing;
+    const bool reuse = m_cacheFile.open(QIODevice::ReadWrite) && m_cacheFile.size() == size &&
+            m_cacheFile.read(reinterpret_cast<char *>(&existing), sizeof(existing)) == sizeof(existing) &&
+            memcmp(&existing, &header, sizeof(header)) == 0;
+    if (!reuse) {
+        // Another player may have the old file mapped, truncating it would
+        // SIGBUS that one. Build a new file and rename it over the old one,
+        // the other player keeps its copy until it unmaps it.
+        m_cacheFile.close();
+        QTemporaryFile fresh(m_cacheFile.fileName() + ".XXXXXX");
+        if (!fresh.open() || !fresh.resize(size) ||
+                fresh.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header) || !fresh.flush() ||
+                std::rename(QFile::encodeName(fresh.fileName()).constData(),
+                            QFile::encodeName(m_cacheFile.fileName()).constData()) != 0) {
+            qWarning() << "Failed to create thumbnail cache" << m_cacheFile.fileName() << fresh.errorString();
+            return false;
+        }
+        if (!m_cacheFile.open(QIODevice::ReadWrite)) {
+            qWarning() << "Failed to open thumbnail cache" << m_cacheFile.fileName() << m_cacheFile.errorString();
+            return false;
+        }
+    }
+
+    uchar *map = m_cacheFile.map(0, size);
+    if (!map) {
+        qWarning() << "Failed to map thumbnail cache" << m_cacheFile.fileName() << m_cacheFile.errorString();
+        m_cacheFile.close();
+        return false;
+    }
+
+    {
+        QMutexLocker locker(&m_mutex);
+        m_map = map;
+        m_count = count;
+        m_intervalMs = intervalMs;
+    }
+
+    int cached = 0;
+    for (int slot = 0; slot < count; slot++) {
+        cached += map[sizeof(Header) + slot] ? 1 : 0;
+    }
+    qDebug() << "thumbnail cache" << m_cacheFile.fileName() << "has" << cached << "of" << count << "thumbnails, one every" << intervalMs << "ms";
+    return true;
+}
+
+void ThumbnailIndex::closeCache()
+{
+    uchar *map;
+    {
+        QMutexLocker locker(&m_mutex);
+        map = m_map;
+        m_map = nullptr;
+        m_count = 0;
+    }
+    if (map) {
+        m_cacheFile.unmap(map);
+    }
+    m_cacheFile.close();
+}
+
+bool ThumbnailIndex::waitForEvent(mpv_handle *mpv, mpv_event_id id)
+{
+    // Give up as soon as there is a new path, the caller loads that instead
+    while (m_running && !m_pending) {
+        const mpv_event *event = mpv_wait_event(mpv, 0.1);
+        if (event->event_id == id) {
+            return true;
+        }
+        // The file we replaced ends before ours starts
+        if ((event->event_id == MPV_EVENT_END_FILE && id != MPV_EVENT_START_FILE) ||
+                event->event_id == MPV_EVENT_SHUTDOWN) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool ThumbnailIndex::decodeThumbnail(mpv_handle *mpv, int slot)
+{
+    const QByteArray time = QByteArray::number(slot * m_intervalMs / 1000.0, 'f', 3);
+    const char *seek[] = {"seek", time.constData(), "absolute+keyframes", NULL};
+    if (mpv_command(mpv, seek) < 0 || !waitForEvent(mpv, MPV_EVENT_PLAYBACK_RESTART)) {
+        return false;
+    }
+
+    mpv_node result;
+    const char *screenshot[] = {"screenshot-raw", "video", NULL};
+    if (mpv_command_ret(mpv, screenshot, &result) < 0) {
+        return false;
+    }
+
+    int64_t width = 0, height = 0, stride = 0;
+    const mpv_byte_array *data = nullptr;
+    if (result.format == MPV_FORMAT_NODE_MAP) {
+        for (int i = 0; i < result.u.list->num; i++) {
+            const char *key = result.u.list->keys[i];
+            const mpv_node &value = result.u.list->values[i];
+            if (strcmp(key, "w") == 0 && value.format == MPV_FORMAT_INT64) {
+                width = value.u.int64;
+            } else if (strcmp(key, "h") == 0 && value.format == MPV_FORMAT_INT64) {
+                height = value.u.int64;
+            } else if (strcmp(key, "stride") == 0 && value.format == MPV_FORMAT_INT64) {
+                stride = value.u.int64;
+            } else if (strcmp(key, "data") == 0 && value.format == MPV_FORMAT_BYTE_ARRAY) {
+                data = value.u.ba;
+            }
+        }
+    }
+
+    // bgr0, the video filter already scaled it down
+    bool ok = false;
+    if (data && width > 0 && height > 0 && stride * height <= qint64(data->size)) {
+        const QImage frame(static_cast<const uchar *>(data->data), int(width), int(height), int(stride), QImage::Format_RGB32);
+        const QImage scaled = frame.size() == QSize(ThumbnailWidth, ThumbnailHeight) ? frame :
+                frame.scaled(ThumbnailWidth, ThumbnailHeight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+
+        uchar *map = m_map;
+        uchar *pixels = map + s_slotsOffset + slot * s_slotSize;
+        for (int y = 0; y < ThumbnailHeight; y++) {
+            memcpy(pixels + y * ThumbnailWidth * 4, scaled.constScanLine(y), ThumbnailWidth * 4);
+        }
+        reinterpret_cast<std::atomic<uchar> *>(map + sizeof(Header) + slot)->store(1, std::memory_order_release);
+        ok = true;
+    }
+    mpv_free_node_contents(&result);
+    return ok;
+}
+
+void ThumbnailIndex::run()
+{
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) {
+        return;
+    }
+
+    // Decode only, one keyframe at a time, scaled down right away so nothing
+    // but the thumbnail ever gets big
+    mpv_set_option_string(mpv, "vo", "null");
+    mpv_set_option_string(mpv, "audio", "no");
+    mpv_set_option_string(mpv, "sub", "no");
+    mpv_set_option_string(mpv, "pause", "yes");
+    mpv_set_option_string(mpv, "keep-open", "yes");
+    mpv_set_option_string(mpv, "hr-seek", "no");
+    mpv_set_option_string(mpv, "hwdec", "no");
+    mpv_set_option_string(mpv, "vd-lavc-threads", "1");
+    mpv_set_option_string(mpv, "vd-lavc-skiploopfilter", "all");
+    mpv_set_option_string(mpv, "cache", "no");
+    mpv_set_option_string(mpv, "demuxer-max-bytes", "16MiB");
+    const QByteArray scale = "scale=" + QByteArray::number(int(ThumbnailWidth)) + ":" + QByteArray::number(int(ThumbnailHeight));
+    mpv_set_option_string(mpv, "vf", scale.constData());
+    if (mpv_initialize(mpv) < 0) {
+        qWarning() << "Failed to initialize mpv for thumbnails";
+        mpv_terminate_destroy(mpv);
+        m_running = false;
+        return;
+    }
+
+    while (takePath()) {
+        indexPath(mpv);
+    }
+
+    closeCache();
+    mpv_terminate_destroy(mpv);
+}
+
+bool ThumbnailIndex::takePath()
+{
+    QMutexLocker locker(&m_mutex);
+    while (m_running && !m_pending) {
+        m_wakeup.wait(&m_mutex);
+    }
+    if (!m_running) {
+        return false;
+    }
+    m_path = m_pendingPath;
+    m_pending = false;
+    return true;
+}
+
+void ThumbnailIndex::indexPath(mpv_handle *mpv)
+{
+    closeCache();
+
+    // Replaces whatever the handle still had open, even mid seek
+    const char *load[] = {"loadfile", m_path.constData(), NULL};
+    double duration = 0;
+    // Only start seeking once the first frame is there, so we don't mistake
+    // that one for where we seeked to
+    if (mpv_command(mpv, load) >= 0 && waitForEvent(mpv, MPV_EVENT_START_FILE) &&
+            waitForEvent(mpv, MPV_EVENT_FILE_LOADED) &&
+            waitForEvent(mpv, MPV_EVENT_PLAYBACK_RESTART) &&
+            mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration) >= 0 && duration > 0 &&
+            openCache(duration)) {
+        const uchar *valid = m_map + sizeof(Header);
+        int decoded = 0;
+        for (int slot = 0; slot < m_count && m_running && !m_pending; slot++) {
+            if (valid[slot]) {
+                continue;
+            }
+            if (decodeThumbnail(mpv, slot)) {
+                decoded++;
+            }
+        }
+        if (decoded > 0) {
+            qDebug() << "decoded" << decoded << "thumbnails for" << m_path;
+        }
+    }
+
+    // Don't keep the demuxer (or a network connection) open while idle
+    if (!m_pending) {
+        const char *stop[] = {"stop", NULL};
+        mpv_command(mpv, stop);
+    }
+}
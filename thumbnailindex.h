@@ -0,0 +1,74 @@
+#ifndef THUMBNAILINDEX_H
+#define THUMBNAILINDEX_H
+
+#include <mpv/client.h>
+#include <atomic>
+#include <QThread>
+#include <QFile>
+#include <QImage>
+#include <QMutex>
+#include <QWaitCondition>
+
+// Seek previews for the playing file. A second, decode only mpv handle walks
+// the video on a background thread and stores a small thumbnail of the whole
+// frame every few seconds in a memory mapped cache file, keyed by a hash of
+// the file. Later sessions just map the file again, and however long the
+// video, the cache holds at most MaxThumbnails of them. The thread and its
+// mpv handle live until the index is destroyed and just load the next path.
+class ThumbnailIndex : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum {
+        ThumbnailWidth = 192,
+        ThumbnailHeight = 96,
+        MaxThumbnails = 512,
+        MinIntervalMs = 5000
+    };
+
+    explicit ThumbnailIndex(QObject *parent);
+    ~ThumbnailIndex();
+
+    // Drops whatever it was indexing before, without waiting for it
+    void index(const QByteArray &path);
+    // Blocks until the thread is gone, only for shutdown
+    void stop();
+
+    // Closest thumbnail at or before the position, null if it isn't there
+    // (yet). Call from the thread that calls index().
+    QImage thumbnail(double seconds) const;
+
+protected:
+    void run() override;
+
+private:
+    struct Header;
+
+    bool takePath();
+    void indexPath(mpv_handle *mpv);
+    bool openCache(double duration);
+    void closeCache();
+    QString cachePath() const;
+    bool waitForEvent(mpv_handle *mpv, mpv_event_id id);
+    bool decodeThumbnail(mpv_handle *mpv, int slot);
+
+    // Only touched by the thread
+    QByteArray m_path;
+    QFile m_cacheFile;
+
+    // Guards the path queued by index(), and the mapping while the thread
+    // swaps it so thumbnail() never reads one that is being unmapped
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeup;
+    QByteArray m_pendingPath;
+    std::atomic_bool m_pending{false};
+    std::atomic_bool m_running{false};
+
+    // The pixels of a slot are written before its valid flag
+    uchar *m_map = nullptr;
+    int m_count = 0;
+    int m_intervalMs = 0;
+};
+
+#endif // THUMBNAILINDEX_H
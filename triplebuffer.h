@@ -0,0 +1,55 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Wait-free single producer, single consumer triple buffer.
+//
+// The producer fills writeBuffer() and calls publish(), the consumer calls
+// update() to pick up the newest published buffer (if there is one) and then
+// reads readBuffer(). Neither side ever waits for the other, the producer just
+// overwrites whatever the consumer hasn't picked up yet.
+template<typename T>
+class TripleBuffer
+{
+public:
+    T &writeBuffer() { return m_buffers[m_back]; }
+
+    void publish()
+    {
+        const int old = m_middle.exchange(m_back | DirtyBit, std::memory_order_acq_rel);
+        m_back = old & IndexMask;
+    }
+
+    // Returns true if there was a new buffer published since the last call
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_acquire) & DirtyBit)) {
+            return false;
+        }
+        const int old = m_middle.exchange(m_front, std::memory_order_acq_rel);
+        m_front = old & IndexMask;
+        return true;
+    }
+
+    const T &readBuffer() const { return m_buffers[m_front]; }
+    T &readBuffer() { return m_buffers[m_front]; }
+
+private:
+    enum {
+        IndexMask = 0x3,
+        DirtyBit = 0x4
+    };
+
+    T m_buffers[3];
+
+    // Only touched by the producer
+    int m_back = 0;
+
+    alignas(64) std::atomic_int m_middle{1};
+
+    // Only touched by the consumer
+    alignas(64) int m_front = 2;
+};
+
+#endif // TRIPLEBUFFER_H
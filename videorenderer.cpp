@@ -0,0 +1,468 @@
+#include "videorenderer.h"
+
+#include "frameprofiler.h"
+#include "rendermetrics.h"
+#include "startuplog.h"
+#include "steadyclock.h"
+
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFramebufferObject>
+#include <QDebug>
+
+static void *get_proc_address(void *ctx, const char *name) {
+    Q_UNUSED(ctx);
+    QOpenGLContext *glctx = QOpenGLContext::currentContext();
+    if (!glctx)
+        return nullptr;
+    return reinterpret_cast<void *>(glctx->getProcAddress(QByteArray(name)));
+}
+
+// What an FBO with its mipmap chain takes on the GPU, roughly
+static qint64 frameBytes(const QSize &size, int mipmapLevels)
+{
+    const qint64 bytes = qint64(size.width()) * size.height() * 4;
+    return mipmapLevels > 1 ? bytes * 4 / 3 : bytes;
+}
+
+static bool setMpvDouble(mpv_handle *mpv, const char *name, double value)
+{
+    const int ret = mpv_set_property(mpv, name, MPV_FORMAT_DOUBLE, &value);
+    if (ret < 0) {
+        qWarning() << "Failed to set" << name << mpv_error_string(ret);
+        return false;
+    }
+    return true;
+}
+
+VideoRenderer::VideoRenderer(mpv_handle *mpv, QObject *parent) : QThread(parent),
+    m_mpv(mpv)
+{
+    setObjectName("VideoRenderer");
+}
+
+VideoRenderer::~VideoRenderer()
+{
+    stopRendering();
+}
+
+void VideoRenderer::startRendering()
+{
+    if (isRunning()) {
+        return;
+    }
+
+    QOpenGLContext *shareContext = QOpenGLContext::globalShareContext();
+    if (!shareContext) {
+        qWarning() << "No global share context, can't render video on a separate thread";
+        return;
+    }
+
+    // The surface has to be created on the GUI thread
+    m_surface = new QOffscreenSurface;
+    m_surface->setFormat(shareContext->format());
+    m_surface->create();
+
+    m_context = new QOpenGLContext;
+    m_context->setFormat(shareContext->format());
+    m_context->setShareContext(shareContext);
+    if (!m_context->create()) {
+        qWarning() << "Failed to create video context";
+        delete m_context;
+        m_context = nullptr;
+        return;
+    }
+    m_context->moveToThread(this);
+
+    m_running = true;
+    start(QThread::HighPriority);
+}
+
+void VideoRenderer::stopRendering()
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_running = false;
+        m_wakeup.wakeAll();
+    }
+    wait();
+
+    delete m_surface;
+    m_surface = nullptr;
+}
+
+void VideoRenderer::setVideoSize(const QSize &size)
+{
+    QMutexLocker locker(&m_mutex);
+    m_targetSize = size;
+    m_wakeup.wakeAll();
+}
+
+void VideoRenderer::setCrop(const QRectF &crop)
+{
+    QMutexLocker locker(&m_mutex);
+    m_requestedCrop = crop;
+    m_wakeup.wakeAll();
+}
+
+void VideoRenderer::setRenderScale(float scale)
+{
+    QMutexLocker locker(&m_mutex);
+    m_requestedScale = qBound(0.1f, scale, 1.f);
+    m_wakeup.wakeAll();
+}
+
+void VideoRenderer::setMipmapLevels(int levels)
+{
+    QMutexLocker locker(&m_mutex);
+    m_requestedMipmapLevels = qMax(1, levels);
+    m_wakeup.wakeAll();
+}
+
+void VideoRenderer::reportSwap()
+{
+    if (m_ready && m_displaySync) {
+        mpv_render_context_report_swap(m_mpvGl);
+    }
+}
+
+void VideoRenderer::onMpvUpdate(void *ctx)
+{
+    VideoRenderer *that = static_cast<VideoRenderer*>(ctx);
+    QMutexLocker locker(&that->m_mutex);
+    that->m_updatePending = true;
+    that->m_wakeup.wakeAll();
+}
+
+void VideoRenderer::run()
+{
+    if (!m_context->makeCurrent(m_surface)) {
+        qWarning() << "Failed to make video context current";
+        return;
+    }
+    initializeOpenGLFunctions();
+    if (m_timing) {
+        m_timing->initializeGL();
+    }
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+
+    mpv_opengl_init_params gl_init_params{get_proc_address, nullptr, nullptr};
+    mpv_render_param params[]{
+        {MPV_RENDER_PARAM_API_TYPE, const_cast<char *>(MPV_RENDER_API_TYPE_OPENGL)},
+        {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &gl_init_params},
+        {MPV_RENDER_PARAM_INVALID, nullptr}
+    };
+
+    if (mpv_render_context_create(&m_mpvGl, m_mpv, params) < 0) {
+        qWarning() << "failed to initialize mpv GL context";
+        m_context->doneCurrent();
+        delete m_context;
+        m_context = nullptr;
+        return;
+    }
+    mpv_render_context_set_update_callback(m_mpvGl, &VideoRenderer::onMpvUpdate, this);
+    StartupLog::mark("mpv render context created");
+
+    m_ready = true;
+    emit ready();
+
+    while (true) {
+        m_mutex.lock();
+        while (m_running && !m_updatePending && m_targetSize == m_renderedSize && m_requestedCrop == m_appliedCrop &&
+               m_requestedScale == m_renderScale && m_requestedMipmapLevels == m_mipmapLevels) {
+            // If mpv doesn't get around to redrawing with a new crop we just
+            // render it ourselves after a while
+            if (m_cropPending) {
+                if (!m_wakeup.wait(&m_mutex, 20)) {
+                    break;
+                }
+            } else {
+                m_wakeup.wait(&m_mutex);
+            }
+        }
+        if (!m_running) {
+            m_mutex.unlock();
+            break;
+        }
+        const QSize targetSize = m_targetSize;
+        const QRectF requestedCrop = m_requestedCrop;
+        const float requestedScale = m_requestedScale;
+        const int requestedMipmapLevels = m_requestedMipmapLevels;
+        m_updatePending = false;
+        m_mutex.unlock();
+
+        if (requestedCrop != m_appliedCrop) {
+            applyCrop(requestedCrop);
+        }
+
+        const bool newFrame = mpv_render_context_update(m_mpvGl) & MPV_RENDER_UPDATE_FRAME;
+        bool force = targetSize != m_renderedSize;
+        if (requestedScale != m_renderScale) {
+            m_renderScale = requestedScale;
+            force = true;
+        }
+        if (requestedMipmapLevels != m_mipmapLevels) {
+            m_mipmapLevels = requestedMipmapLevels;
+            force = true;
+        }
+
+        // mpv applies new pan/scale values asynchronously and redraws when it
+        // has, so switch our mapping over with the next frame it gives us.
+        if (m_cropPending && (newFrame || m_cropTimer.elapsed() > 100)) {
+            m_crop = m_pendingCrop;
+            m_cropPending = false;
+            force = true;
+        }
+
+        if ((newFrame || force) && !targetSize.isEmpty()) {
+            mpv_render_frame_info info{0, 0};
+            if (m_displaySync) {
+                mpv_render_param infoParam{MPV_RENDER_PARAM_NEXT_FRAME_INFO, &info};
+                mpv_render_context_get_info(m_mpvGl, infoParam);
+            }
+            // The compositor keeps showing the one we have, mpv just needs
+            // to move on to the next refresh
+            const bool repeat = (info.flags & MPV_RENDER_FRAME_INFO_REPEAT) && !(info.flags & MPV_RENDER_FRAME_INFO_REDRAW);
+            if (repeat && !force && m_frames.writeBuffer().fbo) {
+                skipFrame();
+            } else {
+                qint64 targetTime = 0;
+                if (info.target_time > 0) {
+                    targetTime = info.target_time * 1000 + SteadyClock::nowNs() - mpv_get_time_us(m_mpv) * 1000;
+                }
+                renderFrame(targetSize, targetTime);
+            }
+        }
+        m_renderedSize = targetSize;
+
+        if (m_timing) {
+            m_timing->collect();
+        }
+    }
+
+    if (m_timing) {
+        m_timing->releaseGL();
+    }
+    releaseFrames();
+    mpv_render_context_free(m_mpvGl);
+    m_mpvGl = nullptr;
+    m_ready = false;
+
+    m_context->doneCurrent();
+    delete m_context;
+    m_context = nullptr;
+}
+
+void VideoRenderer::applyCrop(const QRectF &crop)
+{
+    m_appliedCrop = crop;
+    if (!m_cropSupported) {
+        return;
+    }
+
+    // Scale the video up so the crop fills the whole render target, and pan
+    // so the crop is centered.
+    const bool ok = setMpvDouble(m_mpv, "video-scale-x", 1.0 / crop.width()) &&
+            setMpvDouble(m_mpv, "video-scale-y", 1.0 / crop.height()) &&
+            setMpvDouble(m_mpv, "video-pan-x", 0.5 - crop.center().x()) &&
+            setMpvDouble(m_mpv, "video-pan-y", 0.5 - crop.center().y());
+    if (ok) {
+        m_pendingCrop = crop;
+    } else {
+        qWarning() << "mpv doesn't support video-scale-x/y, disabling viewport crop";
+        m_cropSupported = false;
+        setMpvDouble(m_mpv, "video-scale-x", 1.0);
+        setMpvDouble(m_mpv, "video-scale-y", 1.0);
+        setMpvDouble(m_mpv, "video-pan-x", 0.0);
+        setMpvDouble(m_mpv, "video-pan-y", 0.0);
+        m_pendingCrop = QRectF(0.0, 0.0, 1.0, 1.0);
+    }
+    m_cropPending = true;
+    m_cropTimer.restart();
+}
+
+void VideoRenderer::skipFrame()
+{
+    // Doesn't touch the FBO, but mpv wants one anyway
+    const VideoFrame &frame = m_frames.writeBuffer();
+    mpv_opengl_fbo mpfbo{static_cast<int>(frame.fbo->handle()), frame.renderSize.width(), frame.renderSize.height(), GL_RGBA8};
+    int skip{1};
+    int block{0};
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_OPENGL_FBO, &mpfbo},
+        {MPV_RENDER_PARAM_SKIP_RENDERING, &skip},
+        {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &block},
+        {MPV_RENDER_PARAM_INVALID, nullptr}
+    };
+    mpv_render_context_render(m_mpvGl, params);
+}
+
+void VideoRenderer::renderFrame(const QSize &size, qint64 targetTime)
+{
+    VideoFrame &frame = m_frames.writeBuffer();
+
+    // Don't overwrite it while the compositor might still be sampling from it
+    if (frame.releasedFence) {
+        glWaitSync(frame.releasedFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.releasedFence);
+        frame.releasedFence = nullptr;
+    }
+
+    // Never picked up by the compositor
+    if (frame.renderedFence) {
+        glDeleteSync(frame.renderedFence);
+        frame.renderedFence = nullptr;
+    }
+
+    const QSize textureSize = size.boundedTo(QSize(m_maxTextureSize, m_maxTextureSize));
+    if (!frame.fbo || frame.size != textureSize || frame.mipmapLevels != m_mipmapLevels) {
+        if (textureSize != size && frame.videoSize != size) {
+            qDebug() << "video" << size << "exceeds the maximum texture size, rendering the visible part into" << textureSize;
+        }
+        if (m_metrics) {
+            const qint64 oldBytes = frame.fbo ? frameBytes(frame.size, frame.mipmapLevels) : 0;
+            m_metrics->videoBufferBytes.fetch_add(frameBytes(textureSize, m_mipmapLevels) - oldBytes, std::memory_order_relaxed);
+        }
+        delete frame.fbo;
+        frame.fbo = new QOpenGLFramebufferObject(textureSize);
+        frame.texture = frame.fbo->texture();
+        frame.size = textureSize;
+        frame.mipmapLevels = m_mipmapLevels;
+
+        if (m_mipmapLevels > 1) {
+            // Only the levels the sphere pass can actually end up sampling
+            glBindTexture(GL_TEXTURE_2D, frame.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m_mipmapLevels - 1);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+    }
+
+    // Only the cropped part is rendered, into the corner of the FBO. If the
+    // tiles in view don't fit, because they're near the poles or across the
+    // seam, the whole crop gets scaled down.
+    frame.videoSize = size;
+    frame.crop = m_crop;
+    const qreal width = size.width() * m_crop.width() * m_renderScale;
+    const qreal height = size.height() * m_crop.height() * m_renderScale;
+    const qreal fit = qMin(1., qMin(textureSize.width() / width, textureSize.height() / height));
+    frame.renderSize = QSize(qBound(1, qRound(width * fit), textureSize.width()),
+                             qBound(1, qRound(height * fit), textureSize.height()));
+
+    mpv_opengl_fbo mpfbo{static_cast<int>(frame.fbo->handle()), frame.renderSize.width(), frame.renderSize.height(), GL_RGBA8};
+    int flip_y{0};
+    // With display sync we decide when it goes out, don't let mpv sleep
+    int block{m_displaySync ? 0 : 1};
+
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_OPENGL_FBO, &mpfbo},
+        {MPV_RENDER_PARAM_FLIP_Y, &flip_y},
+        {MPV_RENDER_PARAM_BLOCK_FOR_TARGET_TIME, &block},
+        {MPV_RENDER_PARAM_INVALID, nullptr}
+    };
+    if (m_timing) {
+        m_timing->setFrame(m_serial + 1);
+        m_timing->begin(Timing::MpvRender, true);
+    }
+    mpv_render_context_render(m_mpvGl, params);
+    if (m_timing) {
+        m_timing->end(Timing::MpvRender);
+    }
+
+    // Only for new frames, the compositor just keeps sampling the old chain
+    // while it reprojects.
+    if (frame.mipmapLevels > 1) {
+        if (m_timing) {
+            m_timing->begin(Timing::Mipmaps, true);
+        }
+        padRenderedEdge(frame);
+        glBindTexture(GL_TEXTURE_2D, frame.texture);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        if (m_timing) {
+            m_timing->end(Timing::Mipmaps);
+        }
+    }
+
+    frame.renderedFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    // Rendered ahead, hand it over so that the compositor frame that starts
+    // one refresh before the target time picks it up
+    frame.targetTime = targetTime;
+    if (targetTime > 0) {
+        const qint64 publishTime = targetTime - m_displayInterval * 3 / 2;
+        const qint64 wait = qMin(publishTime - SteadyClock::nowNs(), qint64(100000000));
+        if (wait > 0) {
+            QThread::usleep(wait / 1000);
+        }
+    }
+
+    frame.serial = ++m_serial;
+    m_frames.publish();
+    if (m_metrics) {
+        m_metrics->videoFrames.store(m_serial, std::memory_order_relaxed);
+    }
+
+    emit frameRendered();
+}
+
+void VideoRenderer::padRenderedEdge(const VideoFrame &frame)
+{
+    // mpv only rendered the bottom left renderSize corner, the rest still
+    // has whatever an older crop or scale left there. The coarser mipmap
+    // levels would blend that into the edge of the valid part, so stretch
+    // its last column and row over as many texels as the coarsest level
+    // we build covers.
+    const int padding = 1 << (frame.mipmapLevels - 1);
+    const int width = frame.renderSize.width();
+    const int height = frame.renderSize.height();
+    const int paddedWidth = qMin(width + padding, frame.size.width());
+    const int paddedHeight = qMin(height + padding, frame.size.height());
+    if (paddedWidth == width && paddedHeight == height) {
+        return;
+    }
+
+    // Source and destination never overlap, so this is fine within one FBO
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, frame.fbo->handle());
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, frame.fbo->handle());
+    if (paddedWidth > width) {
+        glBlitFramebuffer(width - 1, 0, width, height,
+                          width, 0, paddedWidth, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    if (paddedHeight > height) {
+        glBlitFramebuffer(0, height - 1, paddedWidth, height,
+                          0, height, paddedWidth, paddedHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VideoRenderer::releaseFrames()
+{
+    VideoFrame *frames[] = { &m_frames.writeBuffer(), &m_frames.readBuffer() };
+    for (VideoFrame *frame : frames) {
+        if (frame->renderedFence) {
+            glDeleteSync(frame->renderedFence);
+        }
+        if (frame->releasedFence) {
+            glDeleteSync(frame->releasedFence);
+        }
+        delete frame->fbo;
+        *frame = VideoFrame();
+    }
+
+    // The one in the middle
+    m_frames.publish();
+    VideoFrame &middle = m_frames.writeBuffer();
+    if (middle.renderedFence) {
+        glDeleteSync(middle.renderedFence);
+    }
+    if (middle.releasedFence) {
+        glDeleteSync(middle.releasedFence);
+    }
+    delete middle.fbo;
+    middle = VideoFrame();
+
+    if (m_metrics) {
+        m_metrics->videoBufferBytes.store(0, std::memory_order_relaxed);
+    }
+}
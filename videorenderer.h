@@ -0,0 +1,169 @@
+#ifndef VIDEORENDERER_H
+#define VIDEORENDERER_H
+
+#include "triplebuffer.h"
+
+#include <mpv/client.h>
+#include <mpv/render_gl.h>
+#include <atomic>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QOpenGLExtraFunctions>
+#include <QElapsedTimer>
+#include <QRectF>
+
+class QOpenGLContext;
+class QOffscreenSurface;
+class QOpenGLFramebufferObject;
+class TimingRecorder;
+struct RenderMetrics;
+
+// One rendered video frame, handed between the video thread and the
+// compositor through a triple buffer. Whoever currently holds it owns it.
+struct VideoFrame
+{
+    // The FBO belongs to the video thread's context, the compositor only ever
+    // touches the (shared) texture.
+    QOpenGLFramebufferObject *fbo = nullptr;
+    GLuint texture = 0;
+    QSize size;
+
+    // Size of the whole video at the requested resolution. Larger than the
+    // texture if that would exceed GL_MAX_TEXTURE_SIZE, then only the tiles
+    // in view (the crop) fit at full resolution.
+    QSize videoSize;
+
+    // mpv rendered the crop of the video frame into the bottom left
+    // renderSize pixels of the texture
+    QRectF crop{0.0, 0.0, 1.0, 1.0};
+    QSize renderSize;
+
+    // Mipmap levels the texture was set up with
+    int mipmapLevels = 1;
+
+    // Signaled when mpv is done rendering into it, waited on by the compositor
+    GLsync renderedFence = nullptr;
+
+    // Signaled when the compositor is done sampling from it, waited on by the
+    // video thread before rendering into it again
+    GLsync releasedFence = nullptr;
+
+    // When mpv wants it on screen, SteadyClock::nowNs(). 0 if mpv leaves
+    // that to the display (display sync) or it is a redraw.
+    qint64 targetTime = 0;
+
+    quint64 serial = 0;
+};
+
+// Runs mpv's rendering on its own thread with a shared GL context, so slow
+// scaling in mpv doesn't hold up presenting to the headset.
+class VideoRenderer : public QThread, protected QOpenGLExtraFunctions
+{
+    Q_OBJECT
+
+public:
+    VideoRenderer(mpv_handle *mpv, QObject *parent);
+    ~VideoRenderer();
+
+    // Times mpv's rendering, set before startRendering()
+    void setTimingRecorder(TimingRecorder *recorder) { m_timing = recorder; }
+
+    // Counts the frames and the memory for them, set before startRendering()
+    void setMetrics(RenderMetrics *metrics) { m_metrics = metrics; }
+
+    // How many mipmap levels to build for every new frame, 1 disables
+    // them. The current frame is rendered again with the new chain.
+    void setMipmapLevels(int levels);
+
+    // For mpv's display synced video-sync modes: frames mpv only repeats for
+    // another refresh aren't rendered again, and frames with a target time
+    // are rendered ahead and handed to the compositor just in time for the
+    // refresh they are meant for.
+    void setDisplaySync(bool enabled) { m_displaySync = enabled; }
+    void setDisplayInterval(qint64 ns) { m_displayInterval = ns; }
+
+    // After every buffer swap of the display, from the GUI thread. Paces
+    // mpv in the display synced modes.
+    void reportSwap();
+
+    // Call from the GUI thread, needs a global share context
+    void startRendering();
+    void stopRendering();
+
+    // The mpv render context is created, ok to loadfile
+    bool isReady() const { return m_ready; }
+
+    // Resolution of the whole video. The FBOs mpv renders into are capped
+    // at GL_MAX_TEXTURE_SIZE, a crop of a larger video is rendered at this
+    // resolution as long as it fits and scaled down otherwise.
+    void setVideoSize(const QSize &size);
+
+    // Which part of the video frame mpv should render, see ViewportCrop
+    void setCrop(const QRectF &crop);
+    bool cropSupported() const { return m_cropSupported; }
+
+    // Render into only this fraction of the texture (on top of the crop),
+    // for dynamic resolution without reallocating
+    void setRenderScale(float scale);
+
+    // Compositor side, returns true if there is a new frame. The compositor
+    // needs to wait for the renderedFence of a new frame, and set the
+    // releasedFence after it is done with it.
+    bool acquireFrame() { return m_frames.update(); }
+    VideoFrame &currentFrame() { return m_frames.readBuffer(); }
+
+signals:
+    void ready();
+    void frameRendered();
+
+protected:
+    void run() override;
+
+private:
+    static void onMpvUpdate(void *ctx);
+    void applyCrop(const QRectF &crop);
+    void renderFrame(const QSize &size, qint64 targetTime);
+    void padRenderedEdge(const VideoFrame &frame);
+    void skipFrame();
+    void releaseFrames();
+
+    mpv_handle *m_mpv = nullptr;
+    mpv_render_context *m_mpvGl = nullptr;
+
+    QOpenGLContext *m_context = nullptr;
+    QOffscreenSurface *m_surface = nullptr;
+    TimingRecorder *m_timing = nullptr;
+    RenderMetrics *m_metrics = nullptr;
+
+    TripleBuffer<VideoFrame> m_frames;
+    quint64 m_serial = 0;
+
+    // Shared with the other threads
+    QMutex m_mutex;
+    QWaitCondition m_wakeup;
+    bool m_running = false;
+    bool m_updatePending = false;
+    QSize m_targetSize;
+    QRectF m_requestedCrop{0.0, 0.0, 1.0, 1.0};
+    float m_requestedScale = 1.f;
+    int m_requestedMipmapLevels = 1;
+
+    std::atomic_bool m_ready{false};
+    std::atomic_bool m_cropSupported{true};
+    std::atomic_bool m_displaySync{false};
+    std::atomic<qint64> m_displayInterval{1000000000 / 60};
+
+    // Only touched by the video thread
+    GLint m_maxTextureSize = 0;
+    QSize m_renderedSize;
+    QRectF m_appliedCrop{0.0, 0.0, 1.0, 1.0};
+    QRectF m_pendingCrop{0.0, 0.0, 1.0, 1.0};
+    QRectF m_crop{0.0, 0.0, 1.0, 1.0};
+    bool m_cropPending = false;
+    QElapsedTimer m_cropTimer;
+    float m_renderScale = 1.f;
+    int m_mipmapLevels = 1;
+};
+
+#endif // VIDEORENDERER_H
@@ -0,0 +1,111 @@
+#include "viewportcrop.h"
+
+#include <QtMath>
+
+static const float s_quantization = 32.f;
+
+QMatrix4x4 ViewportCrop::rotationOnly(const QMatrix4x4 &matrix)
+{
+    QMatrix4x4 rotation;
+    for (int row = 0; row < 3; row++) {
+        for (int column = 0; column < 3; column++) {
+            rotation(row, column) = matrix(row, column);
+        }
+    }
+    return rotation;
+}
+
+// Wraps to (-180, 180]
+static float wrapDegrees(float angle)
+{
+    while (angle > 180.f) {
+        angle -= 360.f;
+    }
+    while (angle <= -180.f) {
+        angle += 360.f;
+    }
+    return angle;
+}
+
+static bool isVisible(const QMatrix4x4 &viewProjection, const QVector3D &direction)
+{
+    const QVector4D clip = viewProjection * QVector4D(direction, 1.f);
+    if (clip.w() <= 0.f) {
+        return false;
+    }
+    return qAbs(clip.x()) <= clip.w() && qAbs(clip.y()) <= clip.w();
+}
+
+QRectF ViewportCrop::visibleRect(const QMatrix4x4 viewProjection[2], float videoAngle, float margin)
+{
+    const QRectF everything(0, 0, 1, 1);
+
+    // Longitudes are relative to where the first eye looks, so we don't have
+    // to care about wrapping around behind the viewer.
+    const QVector3D forward = viewProjection[0].inverted().map(QVector3D(0, 0, 1)).normalized();
+    const float referenceLongitude = qRadiansToDegrees(std::atan2(forward.x(), -forward.z()));
+
+    float minLongitude = 360.f, maxLongitude = -360.f;
+    float minLatitude = 90.f, maxLatitude = -90.f;
+    bool allLongitudes = false;
+
+    for (int eye = 0; eye < 2; eye++) {
+        bool invertible = false;
+        const QMatrix4x4 inverse = viewProjection[eye].inverted(&invertible);
+        if (!invertible) {
+            return everything;
+        }
+
+        // If a pole is in view we can see all longitudes
+        if (isVisible(viewProjection[eye], QVector3D(0, 1, 0))) {
+            maxLatitude = 90.f;
+            allLongitudes = true;
+        }
+        if (isVisible(viewProjection[eye], QVector3D(0, -1, 0))) {
+            minLatitude = -90.f;
+            allLongitudes = true;
+        }
+
+        // Otherwise the extremes are along the edges of the view
+        for (int y = 0; y <= 4; y++) {
+            for (int x = 0; x <= 4; x++) {
+                const QVector3D direction = inverse.map(QVector3D(x / 2.f - 1.f, y / 2.f - 1.f, 1.f)).normalized();
+                const float longitude = wrapDegrees(qRadiansToDegrees(std::atan2(direction.x(), -direction.z())) - referenceLongitude);
+                const float latitude = qRadiansToDegrees(std::asin(qBound(-1.f, direction.y(), 1.f)));
+
+                minLongitude = qMin(minLongitude, longitude);
+                maxLongitude = qMax(maxLongitude, longitude);
+                minLatitude = qMin(minLatitude, latitude);
+                maxLatitude = qMax(maxLatitude, latitude);
+            }
+        }
+    }
+
+    float minU = 0.f, maxU = 1.f;
+    if (!allLongitudes && maxLongitude - minLongitude + 2 * margin < 360.f) {
+        const float center = wrapDegrees(referenceLongitude + (minLongitude + maxLongitude) / 2.f);
+        const float halfSpan = (maxLongitude - minLongitude) / 2.f + margin;
+        minU = 0.5f + (center - halfSpan) / videoAngle;
+        maxU = 0.5f + (center + halfSpan) / videoAngle;
+
+        // For 360 video we can't express a rect that wraps around the seam
+        if (videoAngle >= 360.f && (minU < 0.f || maxU > 1.f)) {
+            minU = 0.f;
+            maxU = 1.f;
+        }
+    }
+
+    const float minV = 0.5f - (maxLatitude + margin) / 180.f;
+    const float maxV = 0.5f - (minLatitude - margin) / 180.f;
+
+    QRectF rect;
+    rect.setLeft(qFloor(qBound(0.f, minU, 1.f) * s_quantization) / s_quantization);
+    rect.setRight(qCeil(qBound(0.f, maxU, 1.f) * s_quantization) / s_quantization);
+    rect.setTop(qFloor(qBound(0.f, minV, 1.f) * s_quantization) / s_quantization);
+    rect.setBottom(qCeil(qBound(0.f, maxV, 1.f) * s_quantization) / s_quantization);
+
+    if (rect.isEmpty()) {
+        return everything;
+    }
+    return rect;
+}
@@ -0,0 +1,22 @@
+#ifndef VIEWPORTCROP_H
+#define VIEWPORTCROP_H
+
+#include <QMatrix4x4>
+#include <QRectF>
+
+namespace ViewportCrop {
+
+// Strips the (odd) translation we get from OpenHMD, we only care about
+// directions when figuring out what is visible.
+QMatrix4x4 rotationOnly(const QMatrix4x4 &matrix);
+
+// Which part of the video can be seen through either of the two view
+// projections (rotation only), in per eye video coordinates, i.e. [0, 1]
+// over videoAngle horizontally and 180 degrees vertically with the top at 0.
+// The rect is grown by margin degrees in all directions and rounded outwards
+// to multiples of 1/32 so it doesn't change on every tiny head movement.
+QRectF visibleRect(const QMatrix4x4 viewProjection[2], float videoAngle, float margin);
+
+} // namespace ViewportCrop
+
+#endif // VIEWPORTCROP_H
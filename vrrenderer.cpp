@@ -0,0 +1,1026 @@
+#include "vrrenderer.h"
+
+#include "ohmdhandler.h"
+#include "startuplog.h"
+#include "steadyclock.h"
+#include "spheremesh.h"
+#include "videorenderer.h"
+#include "viewportcrop.h"
+
+#include <QOpenGLContext>
+#include <QPainter>
+#include <QFile>
+#include <QDebug>
+#include <QtMath>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+#ifndef GL_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_TEXTURE_MAX_ANISOTROPY_EXT 0x84FE
+#endif
+#ifndef GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT
+#define GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT 0x84FF
+#endif
+#ifndef GL_CLIP_DISTANCE0
+#define GL_CLIP_DISTANCE0 0x3000
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+// Matches the std140 layout of EyeBlock in sphere.vert, indexed by which half
+// of the screen the eye ends up in.
+struct EyeUniforms
+{
+    float modelviewProjection[2][16];
+    float minMaxUv[2][4];
+};
+
+// Loads a shader and inserts the given defines, followed by the includes,
+// right after the #version line
+static QByteArray shaderSource(const QString &path, const QByteArrayList &defines = QByteArrayList(),
+                               const QStringList &includes = QStringList())
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Failed to open" << path;
+        return QByteArray();
+    }
+    QByteArray source = file.readAll();
+
+    QByteArray defineLines;
+    for (const QByteArray &define : defines) {
+        defineLines += "#define " + define + "\n";
+    }
+    for (const QString &include : includes) {
+        QFile includeFile(include);
+        if (!includeFile.open(QIODevice::ReadOnly)) {
+            qWarning() << "Failed to open" << include;
+            continue;
+        }
+        defineLines += includeFile.readAll() + "\n";
+    }
+    const int versionEnd = source.indexOf('\n') + 1;
+    source.insert(versionEnd, defineLines);
+    return source;
+}
+
+VrRenderer::VrRenderer(OhmdHandler *ohmd, VideoRenderer *videoRenderer) :
+    m_ohmd(ohmd),
+    m_videoRenderer(videoRenderer),
+    m_sphereVbo(QOpenGLBuffer::VertexBuffer),
+    m_indexBo(QOpenGLBuffer::IndexBuffer),
+    m_distortionVbo(QOpenGLBuffer::VertexBuffer),
+    m_distortionIndexBo(QOpenGLBuffer::IndexBuffer)
+{
+    m_timing = m_profiler.addRecorder("compositor");
+    m_videoRenderer->setTimingRecorder(m_profiler.addRecorder("video"));
+    m_videoRenderer->setMetrics(&m_metrics);
+}
+
+VrRenderer::~VrRenderer()
+{
+    delete m_sphereShader;
+    delete m_distortionShader;
+    delete m_fusedShader;
+}
+
+void VrRenderer::initializeGL()
+{
+    initializeOpenGLFunctions();
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+
+    m_shaderCache.initializeGL();
+
+    // Both eyes are drawn with one instanced draw call, either by selecting
+    // the viewport from the vertex shader, or by squashing each instance into
+    // its half of the screen and clipping away what spills over.
+    QByteArrayList sphereDefines;
+    const QSurfaceFormat glFormat = context->format();
+    const bool hasViewportArray = glFormat.version() >= qMakePair(4, 1) || context->hasExtension("GL_ARB_viewport_array");
+    if (viewportArrayStereo && hasViewportArray && context->hasExtension("GL_ARB_shader_viewport_layer_array")) {
+        sphereDefines << "STEREO_VIEWPORT_ARB";
+    } else if (viewportArrayStereo && hasViewportArray && context->hasExtension("GL_AMD_vertex_shader_viewport_index")) {
+        sphereDefines << "STEREO_VIEWPORT_AMD";
+    }
+    m_viewportIndexedf = nullptr;
+    if (!sphereDefines.isEmpty()) {
+        m_viewportIndexedf = reinterpret_cast<ViewportIndexedf>(context->getProcAddress("glViewportIndexedf"));
+        if (!m_viewportIndexedf) {
+            sphereDefines.clear();
+        }
+    }
+    qDebug() << "stereo rendering with" << (m_viewportIndexedf ? "viewport array" : "clip distances");
+
+    QByteArrayList projectionDefines;
+    if (projectionFormat == EquiAngularCubemap) {
+        projectionDefines << "EAC_PROJECTION";
+    } else if (projectionFormat == Cubemap) {
+        projectionDefines << "CUBEMAP_PROJECTION";
+    }
+    sphereDefines << projectionDefines;
+    const QStringList projectionIncludes{":/shader/projection.glsl"};
+
+    /* Sphere shader */
+    m_sphereShader = new QOpenGLShaderProgram;
+    m_shaderCache.link(m_sphereShader, shaderSource(":/shader/sphere.vert", sphereDefines),
+                       shaderSource(":/shader/sphere.frag", sphereDefines, projectionIncludes));
+
+    m_sphereShader->bind();
+    m_sphereShader->setUniformValue("tex_uni", 0);
+    glUniformBlockBinding(m_sphereShader->programId(), glGetUniformBlockIndex(m_sphereShader->programId(), "EyeBlock"), 0);
+
+    m_sphereShader->release();
+
+    updateSphereMesh();
+    createEyeUniformBuffer();
+
+    // Set the video sampling state once instead of on the texture every frame
+    glGenSamplers(1, &m_videoSampler);
+    glSamplerParameteri(m_videoSampler, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+    glSamplerParameteri(m_videoSampler, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+    glSamplerParameteri(m_videoSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    if (mipmaps) {
+        // Near the poles and at wide fields of view the video gets squashed
+        // a lot, up to 8x is plenty
+        m_videoRenderer->setMipmapLevels(4);
+        glSamplerParameteri(m_videoSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        if (glFormat.version() >= qMakePair(4, 6) || context->hasExtension("GL_EXT_texture_filter_anisotropic") ||
+                context->hasExtension("GL_ARB_texture_filter_anisotropic")) {
+            GLfloat maxAnisotropy = 1.f;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+            glSamplerParameterf(m_videoSampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, qMin(8.f, maxAnisotropy));
+            qDebug() << "video sampled with" << qMin(8.f, maxAnisotropy) << "x anisotropic filtering";
+        }
+    } else {
+        m_videoRenderer->setMipmapLevels(1);
+        glSamplerParameteri(m_videoSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+
+    /* Lens distortion shader */
+    m_distortionShader = new QOpenGLShaderProgram;
+    m_shaderCache.link(m_distortionShader, shaderSource(":/shader/distortion.vert"), shaderSource(":/shader/distortion.frag"));
+    m_distortionShader->bind();
+    m_distortionShader->setUniformValue("eye_tex_uni", 0);
+    m_distortionShader->release();
+
+    if (fusedEyes) {
+        m_fusedShader = new QOpenGLShaderProgram;
+        m_shaderCache.link(m_fusedShader, shaderSource(":/shader/fused.vert"),
+                           shaderSource(":/shader/fused.frag", projectionDefines, projectionIncludes));
+        m_fusedShader->bind();
+        m_fusedShader->setUniformValue("tex_uni", 0);
+        m_fusedShader->setUniformValue("lookup_uni", 1);
+        m_fusedShader->release();
+        m_fusedVao.create();
+    }
+
+    m_timing->initializeGL();
+    m_hud.initializeGL(&m_shaderCache);
+    m_preview.initializeGL(&m_shaderCache);
+
+    const QByteArray shaderStats = QByteArray("shaders linked, ") + QByteArray::number(m_shaderCache.hits()) + " from cache, " +
+            QByteArray::number(m_shaderCache.misses()) + " compiled, in " +
+            QByteArray::number(m_shaderCache.linkNs() / 1e6, 'f', 1) + " ms";
+    StartupLog::mark(shaderStats.constData());
+
+    // The shaders are compiled while the pose thread probes the headset, we
+    // need its lens parameters from the first frame on
+    m_ohmd->waitForInit();
+
+    m_frameCountersTimer.start();
+}
+
+void VrRenderer::releaseGL()
+{
+    m_timing->releaseGL();
+    m_hud.releaseGL();
+    m_preview.releaseGL();
+
+    if (m_mirrorFrame.fence) {
+        glDeleteSync(m_mirrorFrame.fence);
+    }
+    m_mirrorFrame = MirrorFrame();
+    glDeleteTextures(2, m_mirrorTextures);
+    m_mirrorTextures[0] = m_mirrorTextures[1] = 0;
+    m_mirrorSizes[0] = m_mirrorSizes[1] = QSize();
+    if (m_mirrorFbo) {
+        glDeleteFramebuffers(1, &m_mirrorFbo);
+        m_mirrorFbo = 0;
+    }
+
+    for (GLsync &fence : m_eyeUniformFences) {
+        if (fence) {
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+    }
+    if (m_eyeUbo) {
+        glDeleteBuffers(1, &m_eyeUbo);
+        m_eyeUbo = 0;
+        m_eyeUniformsMapped = nullptr;
+    }
+    m_fusedVao.destroy();
+    if (m_lookupTexture) {
+        glDeleteTextures(1, &m_lookupTexture);
+        m_lookupTexture = 0;
+        m_lookupParams = DistortionParams();
+    }
+    if (m_videoSampler) {
+        glDeleteSamplers(1, &m_videoSampler);
+        m_videoSampler = 0;
+    }
+    m_sphereVao.destroy();
+    m_sphereVbo.destroy();
+    m_indexBo.destroy();
+    m_distortionVao.destroy();
+    m_distortionVbo.destroy();
+    m_distortionIndexBo.destroy();
+    delete m_eyeFbo;
+    m_eyeFbo = nullptr;
+    m_metrics.eyeBufferBytes.store(0, std::memory_order_relaxed);
+    m_metrics.mirrorBufferBytes.store(0, std::memory_order_relaxed);
+}
+
+void VrRenderer::render(GLuint targetFbo, const QSize &size, qint64 refreshInterval)
+{
+    m_size = size;
+
+    const qint64 renderTime = SteadyClock::nowNs();
+    if (m_lastRenderTime) {
+        m_metrics.frameInterval.add(renderTime - m_lastRenderTime);
+    }
+    m_lastRenderTime = renderTime;
+
+    m_timing->setFrame(++m_frameNumber);
+    m_timing->collect();
+    if (m_profiler.consume() && showHud) {
+        updateHud();
+    }
+
+    // GPU time is measured across the whole pipeline, including mpv
+    const qint64 gpuTime = m_profiler.takeGpuTime();
+    if (gpuTime > 0) {
+        m_metrics.gpuTime.add(gpuTime);
+    }
+    if (dynamicResolution && m_scaler.addFrame(gpuTime, refreshInterval)) {
+        qDebug() << "GPU time" << m_scaler.averageGpuNs() / 1e6 << "ms of" << refreshInterval / 1e6
+                 << "ms, resolution scale video" << m_scaler.videoScale() << "eyes" << m_scaler.eyeScale();
+        m_videoRenderer->setRenderScale(m_scaler.videoScale());
+    }
+
+    // Pick up the latest frame the video thread finished, if there is one,
+    // otherwise keep reprojecting the one we have.
+    const bool newFrame = m_videoRenderer->acquireFrame();
+    VideoFrame &frame = m_videoRenderer->currentFrame();
+
+    // The crop only knows about equirectangular video
+    if (m_videoRenderer->cropSupported() && projectionFormat == Equirectangular) {
+        const bool tiled = tiledVideo && (frame.videoSize.width() > frame.size.width() ||
+                                          frame.videoSize.height() > frame.size.height());
+        updateVideoCrop(viewportCrop || tiled);
+    }
+    if (newFrame && frame.renderedFence) {
+        glWaitSync(frame.renderedFence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(frame.renderedFence);
+        frame.renderedFence = nullptr;
+    }
+
+    if (newFrame) {
+        m_frameCounters.fresh++;
+        updatePresentationStats(frame, refreshInterval);
+        m_metrics.freshFrames.store(m_frameCounters.fresh, std::memory_order_relaxed);
+        m_metrics.droppedFrames.store(m_frameCounters.dropped, std::memory_order_relaxed);
+        m_metrics.lateFrames.store(m_frameCounters.late, std::memory_order_relaxed);
+    } else {
+        m_frameCounters.reprojected++;
+        m_metrics.reprojectedFrames.store(m_frameCounters.reprojected, std::memory_order_relaxed);
+    }
+
+    if (logStats && m_frameCountersTimer.elapsed() > 1000) {
+        qDebug() << "frames: fresh" << (m_frameCounters.fresh - m_lastFrameCounters.fresh)
+                 << "reprojected" << (m_frameCounters.reprojected - m_lastFrameCounters.reprojected)
+                 << "total fresh" << m_frameCounters.fresh
+                 << "total reprojected" << m_frameCounters.reprojected;
+
+        if (m_frameDurationCount > 0) {
+            m_frameDurationMs = m_frameDurationSum / m_frameDurationCount;
+            m_judderMs = std::sqrt(qMax(0., m_frameDurationSumSq / m_frameDurationCount - m_frameDurationMs * m_frameDurationMs));
+        }
+        m_frameDurationSum = m_frameDurationSumSq = 0;
+        m_frameDurationCount = 0;
+        qDebug() << "video frames shown for" << m_frameDurationMs << "ms, judder" << m_judderMs << "ms, dropped"
+                 << (m_frameCounters.dropped - m_lastFrameCounters.dropped)
+                 << "late" << (m_frameCounters.late - m_lastFrameCounters.late);
+        const PosePredictor::Stats prediction = m_ohmd->takePredictionStats();
+        if (prediction.count > 0) {
+            qDebug() << "prediction error: mean" << prediction.meanError << "max" << prediction.maxError
+                     << "degrees, without prediction" << prediction.meanUnpredictedError;
+        }
+        if (dynamicResolution) {
+            qDebug() << "resolution scale: video" << m_scaler.videoScale() << "eyes" << m_scaler.eyeScale()
+                     << "stepped down" << m_scaler.decreases() << "up" << m_scaler.increases() << "times";
+        }
+        m_lastFrameCounters = m_frameCounters;
+        m_frameCountersTimer.restart();
+    }
+
+    if (!qFuzzyCompare(m_meshVideoAngle, sphereAngle())) {
+        updateSphereMesh();
+    }
+
+    // Sample the pose as late as possible, right before we draw the eyes,
+    // and predict it to when this frame will actually hit the display
+    qint64 lookahead = predictionMs * 1000000;
+    if (predictionMs < 0) {
+        lookahead = refreshInterval;
+    }
+    m_timing->begin(Timing::PoseUpdate);
+    m_ohmd->update(lookahead > 0 ? SteadyClock::nowNs() + lookahead : 0);
+    m_timing->end(Timing::PoseUpdate);
+    if (m_ohmd->poseTimestamp) {
+        m_metrics.poseAgeNs.store(SteadyClock::nowNs() - m_ohmd->poseTimestamp, std::memory_order_relaxed);
+    }
+
+    const DistortionParams distortion = m_ohmd->distortionParams();
+    const bool correctLenses = lensCorrection && distortion.isValid();
+    const bool fused = correctLenses && m_fusedShader;
+    if (fused) {
+        updateDistortionLookup(distortion);
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+        m_eyeBufferSize = m_size;
+    } else if (correctLenses) {
+        if (distortion != m_distortionParams) {
+            updateDistortionMesh(distortion);
+        }
+        if (!m_eyeFbo || m_eyeFbo->size() != m_size) {
+            delete m_eyeFbo;
+            m_eyeFbo = new QOpenGLFramebufferObject(m_size);
+            m_metrics.eyeBufferBytes.store(qint64(m_size.width()) * m_size.height() * 4, std::memory_order_relaxed);
+            glBindTexture(GL_TEXTURE_2D, m_eyeFbo->texture());
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        m_eyeFbo->bind();
+
+        // Scaled down by rendering into a corner of the full size buffer,
+        // so we don't have to reallocate it. Keep the width even so both
+        // eyes get the same.
+        const float eyeScale = dynamicResolution ? m_scaler.eyeScale() : 1.f;
+        m_eyeBufferSize = QSize(qMax(2, qRound(m_size.width() * eyeScale / 2) * 2),
+                                qMax(1, qRound(m_size.height() * eyeScale)));
+    } else {
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+        m_eyeBufferSize = m_size;
+    }
+
+    glViewport(0, 0, m_size.width(), m_size.height());
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+
+    if (frame.texture) {
+        m_timing->begin(Timing::Eyes, true);
+        if (fused) {
+            renderFused(frame);
+        } else {
+            renderEyes(frame);
+        }
+        m_timing->end(Timing::Eyes);
+
+        // Let the video thread know when it can render into it again
+        if (frame.releasedFence) {
+            glDeleteSync(frame.releasedFence);
+        }
+        frame.releasedFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    if (showHud) {
+        renderHud();
+    }
+    if (m_previewTimer.isValid() && m_previewTimer.elapsed() < 1500) {
+        renderPreview();
+    }
+
+    if (correctLenses && !fused) {
+        glBindFramebuffer(GL_FRAMEBUFFER, targetFbo);
+        m_timing->begin(Timing::Distortion, true);
+        renderDistortion();
+        m_timing->end(Timing::Distortion);
+    }
+
+    if (mirrorRate > 0 && (!m_mirrorTimer.isValid() || m_mirrorTimer.nsecsElapsed() >= 1e9 / mirrorRate)) {
+        m_mirrorTimer.start();
+        if (correctLenses && !fused && !mirrorDistorted) {
+            copyToMirror(m_eyeFbo->handle(), QRect(QPoint(0, 0), m_eyeBufferSize));
+        } else {
+            copyToMirror(targetFbo, QRect(QPoint(0, 0), m_size));
+        }
+    }
+}
+
+void VrRenderer::updatePresentationStats(const VideoFrame &frame, qint64 refreshInterval)
+{
+    // Rendered after the last one we showed, but never picked up
+    if (m_lastFrameSerial && frame.serial > m_lastFrameSerial + 1) {
+        m_frameCounters.dropped += frame.serial - m_lastFrameSerial - 1;
+    }
+    m_lastFrameSerial = frame.serial;
+
+    // This goes out with the next refresh
+    const qint64 now = SteadyClock::nowNs();
+    if (frame.targetTime > 0 && now + refreshInterval > frame.targetTime + refreshInterval / 2) {
+        m_frameCounters.late++;
+    }
+
+    // Leave out pauses and seeks
+    const qint64 duration = now - m_lastFrameTime;
+    if (m_lastFrameTime && duration < 250000000) {
+        const double ms = duration / 1e6;
+        m_frameDurationSum += ms;
+        m_frameDurationSumSq += ms * ms;
+        m_frameDurationCount++;
+    }
+    m_lastFrameTime = now;
+}
+
+void VrRenderer::copyToMirror(GLuint sourceFbo, const QRect &source)
+{
+    // All of it, 1:1. The window's buffer might be multisampled, and
+    // resolving needs the same source and destination rectangle. The mirror
+    // picks the eye and scales it.
+    QRect rect(QPoint(0, 0), source.size());
+    if (mirrorEyes == MirrorLeftEye) {
+        rect.setWidth(source.width() / 2);
+    } else if (mirrorEyes == MirrorRightEye) {
+        rect.setLeft(source.width() / 2);
+    }
+
+    m_mirrorIndex = 1 - m_mirrorIndex;
+    GLuint &texture = m_mirrorTextures[m_mirrorIndex];
+    if (!texture) {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    if (m_mirrorSizes[m_mirrorIndex] != source.size()) {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, source.width(), source.height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        m_mirrorSizes[m_mirrorIndex] = source.size();
+        qint64 bytes = 0;
+        for (const QSize &size : m_mirrorSizes) {
+            bytes += qint64(size.width()) * size.height() * 4;
+        }
+        m_metrics.mirrorBufferBytes.store(bytes, std::memory_order_relaxed);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (!m_mirrorFbo) {
+        glGenFramebuffers(1, &m_mirrorFbo);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, sourceFbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_mirrorFbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glBlitFramebuffer(source.left(), source.top(), source.right() + 1, source.bottom() + 1,
+                      0, 0, source.width(), source.height(), GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, sourceFbo);
+
+    // The mirror never picked up the previous one
+    if (m_mirrorFrame.fence) {
+        glDeleteSync(m_mirrorFrame.fence);
+    }
+    m_mirrorFrame.texture = texture;
+    m_mirrorFrame.size = source.size();
+    m_mirrorFrame.rect = rect;
+    m_mirrorFrame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    // Otherwise the other context might wait for a fence that never gets
+    // to the GPU
+    glFlush();
+}
+
+VrRenderer::MirrorFrame VrRenderer::takeMirrorFrame()
+{
+    const MirrorFrame frame = m_mirrorFrame;
+    m_mirrorFrame = MirrorFrame();
+    return frame;
+}
+
+void VrRenderer::updateSphereMesh()
+{
+    SphereMesh mesh;
+    mesh.generate(sphereAngle());
+    m_meshVideoAngle = sphereAngle();
+
+    if (!m_sphereVao.isCreated()) {
+        m_sphereVao.create();
+    }
+    m_sphereVao.bind();
+
+    if (!m_sphereVbo.isCreated()) {
+        m_sphereVbo.create();
+        m_sphereVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    }
+    m_sphereVbo.bind();
+    m_sphereVbo.allocate(mesh.vertices.constData(), mesh.vertices.size() * sizeof(SphereVertex));
+
+    if (!m_indexBo.isCreated()) {
+        m_indexBo.create();
+        m_indexBo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    }
+    m_indexBo.bind();
+    m_indexBo.allocate(mesh.indices.constData(), mesh.indices.size() * sizeof(quint16));
+    m_sphereIndexCount = mesh.indices.size();
+
+    m_sphereShader->enableAttributeArray(0);
+    m_sphereShader->setAttributeBuffer(0, GL_FLOAT, offsetof(SphereVertex, position), 3, sizeof(SphereVertex));
+    m_sphereShader->enableAttributeArray(1);
+    m_sphereShader->setAttributeBuffer(1, GL_FLOAT, offsetof(SphereVertex, uv), 2, sizeof(SphereVertex));
+
+    // The index buffer binding is part of the VAO state, so leave it bound
+    m_sphereVao.release();
+    m_sphereVbo.release();
+
+    qDebug() << "sphere mesh for" << m_meshVideoAngle << "degrees:" << mesh.vertices.size() << "vertices," << m_sphereIndexCount << "indices";
+}
+
+void VrRenderer::updateDistortionMesh(const DistortionParams &params)
+{
+    DistortionMesh mesh;
+    mesh.generate(params);
+    m_distortionParams = params;
+
+    if (!m_distortionVao.isCreated()) {
+        m_distortionVao.create();
+    }
+    m_distortionVao.bind();
+
+    if (!m_distortionVbo.isCreated()) {
+        m_distortionVbo.create();
+        m_distortionVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    }
+    m_distortionVbo.bind();
+    m_distortionVbo.allocate(mesh.vertices.constData(), mesh.vertices.size() * sizeof(DistortionVertex));
+
+    if (!m_distortionIndexBo.isCreated()) {
+        m_distortionIndexBo.create();
+        m_distortionIndexBo.setUsagePattern(QOpenGLBuffer::StaticDraw);
+    }
+    m_distortionIndexBo.bind();
+    m_distortionIndexBo.allocate(mesh.indices.constData(), mesh.indices.size() * sizeof(quint16));
+    m_distortionIndexCount = mesh.indices.size();
+
+    m_distortionShader->enableAttributeArray(0);
+    m_distortionShader->setAttributeBuffer(0, GL_FLOAT, offsetof(DistortionVertex, position), 2, sizeof(DistortionVertex));
+    m_distortionShader->enableAttributeArray(1);
+    m_distortionShader->setAttributeBuffer(1, GL_FLOAT, offsetof(DistortionVertex, uvRed), 2, sizeof(DistortionVertex));
+    m_distortionShader->enableAttributeArray(2);
+    m_distortionShader->setAttributeBuffer(2, GL_FLOAT, offsetof(DistortionVertex, uvGreen), 2, sizeof(DistortionVertex));
+    m_distortionShader->enableAttributeArray(3);
+    m_distortionShader->setAttributeBuffer(3, GL_FLOAT, offsetof(DistortionVertex, uvBlue), 2, sizeof(DistortionVertex));
+    m_distortionShader->enableAttributeArray(4);
+    m_distortionShader->setAttributeBuffer(4, GL_FLOAT, offsetof(DistortionVertex, eyeOffset), 1, sizeof(DistortionVertex));
+
+    m_distortionVao.release();
+    m_distortionVbo.release();
+
+    qDebug() << "distortion mesh rebuilt:" << mesh.vertices.size() << "vertices";
+}
+
+void VrRenderer::renderDistortion()
+{
+    glViewport(0, 0, m_size.width(), m_size.height());
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    m_distortionShader->bind();
+    m_distortionShader->setUniformValue("eye_scale_uni", QVector2D(float(m_eyeBufferSize.width()) / m_eyeFbo->width(),
+                                                                   float(m_eyeBufferSize.height()) / m_eyeFbo->height()));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_eyeFbo->texture());
+
+    m_distortionVao.bind();
+    glDrawElements(GL_TRIANGLES, m_distortionIndexCount, GL_UNSIGNED_SHORT, nullptr);
+    m_distortionVao.release();
+
+    m_distortionShader->release();
+}
+
+void VrRenderer::updateDistortionLookup(const DistortionParams &params)
+{
+    // Half the display resolution is plenty for something this smooth, keep
+    // the width even so both eyes get the same
+    const QSize size(qMax(2, m_size.width() / 4 * 2), qMax(1, m_size.height() / 2));
+    if (params == m_lookupParams && size == m_lookup.size && qFuzzyCompare(m_lookupFov, fieldOfView)) {
+        return;
+    }
+
+    // Same as eyeProjection()
+    float tanHalfFov[2];
+    tanHalfFov[1] = std::tan(qDegreesToRadians(fieldOfView / 2.f));
+    tanHalfFov[0] = tanHalfFov[1] * float(m_size.width() / 2) / m_size.height();
+    m_lookup.generate(params, size, tanHalfFov);
+    m_lookupParams = params;
+    m_lookupFov = fieldOfView;
+
+    if (!m_lookupTexture) {
+        glGenTextures(1, &m_lookupTexture);
+        glBindTexture(GL_TEXTURE_2D, m_lookupTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(GL_TEXTURE_2D, m_lookupTexture);
+    }
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, size.width(), size.height(), 0, GL_RG, GL_FLOAT, m_lookup.texels.constData());
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_fusedShader->bind();
+    m_fusedShader->setUniformValue("tan_half_fov_uni", QVector2D(tanHalfFov[0], tanHalfFov[1]));
+    m_fusedShader->setUniformValue("aberration_uni", QVector2D(m_lookup.aberration[0], m_lookup.aberration[1]));
+    const QVector2D lensCenter[2] = {
+        QVector2D(m_lookup.lensCenter[0][0], m_lookup.lensCenter[0][1]),
+        QVector2D(m_lookup.lensCenter[1][0], m_lookup.lensCenter[1][1])
+    };
+    m_fusedShader->setUniformValueArray("lens_center_uni", lensCenter, 2);
+    m_fusedShader->release();
+
+    qDebug() << "distortion lookup rebuilt:" << size;
+}
+
+void VrRenderer::renderFused(const VideoFrame &frame)
+{
+    QMatrix4x4 headRotation;
+    headRotation.rotate(rotHor, QVector3D(0, 1, 0));
+    headRotation.rotate(rotVert, QVector3D(1, 0, 0));
+
+    QMatrix3x3 eyeToVideo[2];
+    QVector4D minMaxUv[2];
+    for (int eye = 0; eye < 2; eye++) {
+        const int side = invert_stereo ? 1 - eye : eye;
+
+        // Just a rotation, so the inverse is the transpose
+        const QMatrix4x4 rotation = headRotation * ViewportCrop::rotationOnly(m_ohmd->modelView[eye]);
+        eyeToVideo[side] = rotation.normalMatrix().transposed();
+        minMaxUv[side] = eyeUvRect(frame, side);
+    }
+
+    m_fusedShader->bind();
+    m_fusedShader->setUniformValueArray("eye_to_video_uni", eyeToVideo, 2);
+    m_fusedShader->setUniformValueArray("min_max_uv_uni", minMaxUv, 2);
+    m_fusedShader->setUniformValue("video_angle_uni", GLfloat(qDegreesToRadians(videoAngle)));
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, m_lookupTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frame.texture);
+    glBindSampler(0, m_videoSampler);
+
+    // Everything comes from gl_VertexID and gl_InstanceID
+    glViewport(0, 0, m_size.width(), m_size.height());
+    m_fusedVao.bind();
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, 2);
+    m_fusedVao.release();
+
+    glBindSampler(0, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    m_fusedShader->release();
+}
+
+void VrRenderer::updateHud()
+{
+    QStringList lines = m_profiler.summary();
+    if (lines.isEmpty()) {
+        return;
+    }
+    lines.append(QString("video frames %1 ms, judder %2 ms, dropped %3, late %4, repeated %5")
+                 .arg(m_frameDurationMs, 0, 'f', 1)
+                 .arg(m_judderMs, 0, 'f', 1)
+                 .arg(m_frameCounters.dropped)
+                 .arg(m_frameCounters.late)
+                 .arg(m_frameCounters.reprojected));
+    if (dynamicResolution) {
+        lines.append(QString("resolution video %1 eyes %2, stepped down %3 up %4 times")
+                     .arg(m_scaler.videoScale(), 0, 'f', 2)
+                     .arg(m_scaler.eyeScale(), 0, 'f', 2)
+                     .arg(m_scaler.decreases())
+                     .arg(m_scaler.increases()));
+    }
+
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    font.setPixelSize(14);
+    const QFontMetrics metrics(font);
+    int textWidth = 0;
+    for (const QString &line : lines) {
+        textWidth = qMax(textWidth, metrics.horizontalAdvance(line));
+    }
+
+    QImage image(textWidth + 16, metrics.lineSpacing() * lines.count() + 16, QImage::Format_ARGB32_Premultiplied);
+    image.fill(QColor(0, 0, 0, 160));
+    QPainter painter(&image);
+    painter.setFont(font);
+    painter.setPen(Qt::white);
+    for (int i = 0; i < lines.count(); i++) {
+        painter.drawText(8, 8 + metrics.ascent() + i * metrics.lineSpacing(), lines[i]);
+    }
+    painter.end();
+
+    m_hud.setImage(image);
+}
+
+void VrRenderer::renderHud()
+{
+    if (m_hud.isEmpty()) {
+        return;
+    }
+
+    // Same spot in both eyes, a bit below the center so it is readable
+    // without being in the way.
+    const int eyeWidth = m_size.width() / 2;
+    const qreal hudWidth = qMin(1.5, 2.0 * m_hud.size().width() / eyeWidth);
+    const qreal hudHeight = hudWidth * m_hud.size().height() / m_hud.size().width() * eyeWidth / m_size.height();
+    renderOverlay(m_hud, QRectF(-hudWidth / 2, -0.2 - hudHeight, hudWidth, hudHeight));
+}
+
+void VrRenderer::showPreview(const QImage &image)
+{
+    m_preview.setImage(image);
+    m_previewTimer.start();
+}
+
+void VrRenderer::renderPreview()
+{
+    if (m_preview.isEmpty()) {
+        return;
+    }
+
+    // Above the center, the opposite of the HUD
+    const int eyeWidth = m_size.width() / 2;
+    const qreal previewWidth = 0.8;
+    const qreal previewHeight = previewWidth * m_preview.size().height() / m_preview.size().width() * eyeWidth / m_size.height();
+    renderOverlay(m_preview, QRectF(-previewWidth / 2, 0.2, previewWidth, previewHeight));
+}
+
+void VrRenderer::renderOverlay(Overlay &overlay, const QRectF &rect)
+{
+    const int scaledEyeWidth = m_eyeBufferSize.width() / 2;
+    for (int eye = 0; eye < 2; eye++) {
+        glViewport(eye * scaledEyeWidth, 0, scaledEyeWidth, m_eyeBufferSize.height());
+        overlay.render(rect);
+    }
+}
+
+void VrRenderer::createEyeUniformBuffer()
+{
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    m_eyeUniformStride = (sizeof(EyeUniforms) + alignment - 1) / alignment * alignment;
+
+    glGenBuffers(1, &m_eyeUbo);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_eyeUbo);
+
+    // Map it once and keep it mapped if we can, and cycle through a few
+    // regions so we never write to something the GPU might still be reading.
+    const GLsizeiptr bufferSize = m_eyeUniformStride * EyeUniformRegions;
+    typedef void (QOPENGLF_APIENTRYP BufferStorage)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+    BufferStorage bufferStorage = nullptr;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context->format().version() >= qMakePair(4, 4) || context->hasExtension("GL_ARB_buffer_storage")) {
+        bufferStorage = reinterpret_cast<BufferStorage>(context->getProcAddress("glBufferStorage"));
+    }
+
+    m_eyeUniformsMapped = nullptr;
+    if (bufferStorage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        bufferStorage(GL_UNIFORM_BUFFER, bufferSize, nullptr, flags);
+        m_eyeUniformsMapped = static_cast<char*>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, bufferSize, flags));
+    }
+    if (!m_eyeUniformsMapped) {
+        glBufferData(GL_UNIFORM_BUFFER, bufferSize, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    qDebug() << "eye uniforms" << (m_eyeUniformsMapped ? "persistently mapped" : "uploaded every frame");
+}
+
+QVector4D VrRenderer::eyeUvRect(const VideoFrame &frame, int side) const
+{
+    QRectF rect(0.0, 0.0, 1.0, 1.0);
+    switch(video_projection_mode)
+    {
+        case Monoscopic:
+            break;
+        case OverUnder:
+            if(side == 1)
+                rect = QRectF(0.0, 0.5, 1.0, 0.5);
+            else
+                rect = QRectF(0.0, 0.0, 1.0, 0.5);
+            break;
+        case SideBySide:
+            if(side == 1)
+                rect = QRectF(0.5, 0.0, 0.5, 1.0);
+            else
+                rect = QRectF(0.0, 0.0, 0.5, 1.0);
+            break;
+    }
+
+    // mpv only rendered the cropped part of the frame, into the bottom left
+    // corner of the texture
+    const QRectF &crop = frame.crop;
+    const qreal scaleX = qreal(frame.renderSize.width()) / frame.size.width() / crop.width();
+    const qreal scaleY = qreal(frame.renderSize.height()) / frame.size.height() / crop.height();
+    return QVector4D((rect.left() - crop.left()) * scaleX,
+                     (rect.top() - crop.top()) * scaleY,
+                     (rect.right() - crop.left()) * scaleX,
+                     (rect.bottom() - crop.top()) * scaleY);
+}
+
+QSize VrRenderer::videoTextureSize(const QSize &source, const QSize &output) const
+{
+    if (source.isEmpty()) {
+        return source;
+    }
+
+    QSize size = source;
+    if (videoScale > 0 && !output.isEmpty()) {
+        // Pixels per degree at the centre of an eye, eyeProjection() uses
+        // fieldOfView vertically over the full height of the eye buffer
+        const qreal focalLength = output.height() / 2. / std::tan(qDegreesToRadians(fieldOfView / 2.));
+        const qreal pixelsPerDegree = qDegreesToRadians(focalLength) * videoScale;
+
+        // How much of the frame each eye gets, the sphere covers videoAngle
+        // degrees horizontally and 180 vertically
+        qreal eyeWidth = 1, eyeHeight = 1;
+        if (video_projection_mode == SideBySide) {
+            eyeWidth = 0.5;
+        } else if (video_projection_mode == OverUnder) {
+            eyeHeight = 0.5;
+        }
+        qreal neededWidth = pixelsPerDegree * videoAngle / eyeWidth;
+        qreal neededHeight = pixelsPerDegree * 180. / eyeHeight;
+        if (projectionFormat != Equirectangular) {
+            // 3x2 faces of 90 degrees each. EAC spreads them evenly, a plain
+            // cube face is sparsest in the middle and needs 4/pi times as
+            // many pixels for the same density there.
+            qreal faceSize = pixelsPerDegree * 90.;
+            if (projectionFormat == Cubemap) {
+                faceSize *= 4. / M_PI;
+            }
+            neededWidth = faceSize * 3. / eyeWidth;
+            neededHeight = faceSize * 2. / eyeHeight;
+        }
+
+        // Scale both axes the same, mpv would letterbox otherwise
+        const qreal scale = qMin(1., qMax(neededWidth / source.width(), neededHeight / source.height()));
+
+        // Round up a bit so small changes don't make us reallocate
+        size = QSize(qMin(source.width(), (qCeil(source.width() * scale) + 15) / 16 * 16),
+                     qMin(source.height(), (qCeil(source.height() * scale) + 15) / 16 * 16));
+    }
+
+    if (!tiledVideo && (size.width() > m_maxTextureSize || size.height() > m_maxTextureSize)) {
+        size = size.scaled(QSize(m_maxTextureSize, m_maxTextureSize), Qt::KeepAspectRatio);
+    }
+    return size;
+}
+
+QMatrix4x4 VrRenderer::eyeProjection() const
+{
+    QMatrix4x4 projection;
+    projection.perspective(fieldOfView, ((float)(m_size.width()/2)) / (float)m_size.height(), 0.1f, 1000.0f);
+    projection.rotate(rotHor, QVector3D(0, 1, 0));
+    projection.rotate(rotVert, QVector3D(1, 0, 0));
+    return projection;
+}
+
+float VrRenderer::sphereAngle() const
+{
+    return projectionFormat == Equirectangular ? videoAngle : 360.f;
+}
+
+QRectF VrRenderer::frameCrop(const QRectF &visible) const
+{
+    // With stereo we can only crop along the axis the eyes aren't packed on
+    switch(video_projection_mode)
+    {
+        case Monoscopic:
+            return visible;
+        case OverUnder:
+            return QRectF(visible.left(), 0.0, visible.width(), 1.0);
+        case SideBySide:
+            return QRectF(0.0, visible.top(), 1.0, visible.height());
+    }
+    return QRectF(0.0, 0.0, 1.0, 1.0);
+}
+
+void VrRenderer::updateVideoCrop(bool crop)
+{
+    if (!crop) {
+        // E.g. the video got small enough to fit after all
+        const QRectF everything(0.0, 0.0, 1.0, 1.0);
+        if (m_requestedCrop != everything) {
+            m_requestedCrop = everything;
+            m_videoRenderer->setCrop(everything);
+        }
+        return;
+    }
+
+    const QMatrix4x4 projection = eyeProjection();
+    QMatrix4x4 viewProjection[2];
+    for (int eye = 0; eye < 2; eye++) {
+        viewProjection[eye] = projection * ViewportCrop::rotationOnly(m_ohmd->modelView[eye]);
+    }
+
+    // Only change it when we're getting close to the edge, or when we're
+    // rendering a lot more than we need to.
+    const QRectF current = m_requestedCrop;
+    const QRectF needed = frameCrop(ViewportCrop::visibleRect(viewProjection, videoAngle, cropMargin / 2));
+    const QRectF wanted = frameCrop(ViewportCrop::visibleRect(viewProjection, videoAngle, cropMargin));
+    const qreal currentArea = current.width() * current.height();
+    const qreal wantedArea = wanted.width() * wanted.height();
+    if (wanted == current || (current.contains(needed) && currentArea < wantedArea * 1.5)) {
+        return;
+    }
+
+    m_requestedCrop = wanted;
+    m_videoRenderer->setCrop(wanted);
+}
+
+void VrRenderer::renderEyes(const VideoFrame &frame)
+{
+    const int w = m_eyeBufferSize.width();
+    const int h = m_eyeBufferSize.height();
+
+    const QMatrix4x4 projection = eyeProjection();
+
+    EyeUniforms uniforms;
+    for (int eye = 0; eye < 2; eye++) {
+        const int side = invert_stereo ? 1 - eye : eye;
+
+        const QMatrix4x4 modelviewProjection = projection * m_ohmd->modelView[eye];
+        memcpy(uniforms.modelviewProjection[side], modelviewProjection.constData(), sizeof(uniforms.modelviewProjection[side]));
+
+        const QVector4D uvRect = eyeUvRect(frame, side);
+        uniforms.minMaxUv[side][0] = uvRect.x();
+        uniforms.minMaxUv[side][1] = uvRect.y();
+        uniforms.minMaxUv[side][2] = uvRect.z();
+        uniforms.minMaxUv[side][3] = uvRect.w();
+    }
+
+    // Write this frame's uniforms into the next region
+    m_eyeUniformRegion = (m_eyeUniformRegion + 1) % EyeUniformRegions;
+    const GLintptr offset = m_eyeUniformRegion * m_eyeUniformStride;
+    GLsync &fence = m_eyeUniformFences[m_eyeUniformRegion];
+    if (m_eyeUniformsMapped) {
+        if (fence) {
+            glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            glDeleteSync(fence);
+            fence = nullptr;
+        }
+        memcpy(m_eyeUniformsMapped + offset, &uniforms, sizeof(uniforms));
+    } else {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_eyeUbo);
+        glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(uniforms), &uniforms);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    m_sphereShader->bind();
+    glBindBufferRange(GL_UNIFORM_BUFFER, 0, m_eyeUbo, offset, sizeof(uniforms));
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, frame.texture);
+    glBindSampler(0, m_videoSampler);
+
+    if (m_viewportIndexedf) {
+        m_viewportIndexedf(0, 0, 0, w/2, h);
+        m_viewportIndexedf(1, w/2, 0, w/2, h);
+    } else {
+        glViewport(0, 0, w, h);
+        glEnable(GL_CLIP_DISTANCE0);
+    }
+
+    m_sphereVao.bind();
+    glDrawElementsInstanced(GL_TRIANGLES, m_sphereIndexCount, GL_UNSIGNED_SHORT, nullptr, 2);
+    m_sphereVao.release();
+
+    if (!m_viewportIndexedf) {
+        glDisable(GL_CLIP_DISTANCE0);
+    }
+
+    glBindSampler(0, 0);
+    m_sphereShader->release();
+
+    if (m_eyeUniformsMapped) {
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
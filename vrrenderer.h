@@ -0,0 +1,278 @@
+#ifndef VRRENDERER_H
+#define VRRENDERER_H
+
+#include "distortionmesh.h"
+#include "frameprofiler.h"
+#include "overlay.h"
+#include "rendermetrics.h"
+#include "resolutionscaler.h"
+#include "shadercache.h"
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+#include <QOpenGLBuffer>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+
+class OhmdHandler;
+class VideoRenderer;
+struct VideoFrame;
+
+#define DEFAULT_FOV 80
+
+// Composites the newest video frame onto the sphere for both eyes and
+// corrects for the lenses. Doesn't care what it renders into, so the player
+// window and the benchmark share it.
+class VrRenderer : protected QOpenGLExtraFunctions
+{
+public:
+    enum VideoProjectionMode
+    {
+        Monoscopic,
+        OverUnder,
+        SideBySide
+    } video_projection_mode = SideBySide;
+
+    // How the sphere is mapped onto each eye's part of the frame. The cube
+    // formats use a 3x2 grid of faces and always cover 360 degrees. Set
+    // before initializeGL().
+    enum ProjectionFormat
+    {
+        Equirectangular,
+        EquiAngularCubemap,
+        Cubemap
+    } projectionFormat = Equirectangular;
+
+    VrRenderer(OhmdHandler *ohmd, VideoRenderer *videoRenderer);
+    ~VrRenderer();
+
+    // With the context current
+    void initializeGL();
+    void releaseGL();
+
+    // Renders both eyes side by side into targetFbo. The pose is predicted
+    // to refreshInterval from now if predictionMs is negative.
+    void render(GLuint targetFbo, const QSize &size, qint64 refreshInterval);
+
+    // Ends with the buffer swap, the window does that
+    void beginSwap() { m_timing->begin(Timing::Swap); }
+    void endSwap() { m_timing->end(Timing::Swap); }
+
+    GLint maxTextureSize() const { return m_maxTextureSize; }
+
+    // Size for the texture mpv renders into, so that at the centre of each
+    // eye one video texel ends up on roughly one pixel of an output of the
+    // given size. Never larger than the source, nor GL_MAX_TEXTURE_SIZE
+    // unless tiledVideo is set.
+    QSize videoTextureSize(const QSize &source, const QSize &output) const;
+
+    FrameProfiler &profiler() { return m_profiler; }
+
+    // How many of the presented frames had a new video frame from mpv, and
+    // how many just reprojected the previous one with a new pose. Dropped
+    // video frames were rendered but replaced before we got to show them,
+    // late ones went out after the refresh mpv meant them for.
+    struct FrameCounters {
+        quint64 fresh = 0;
+        quint64 reprojected = 0;
+        quint64 dropped = 0;
+        quint64 late = 0;
+    };
+    FrameCounters frameCounters() const { return m_frameCounters; }
+
+    // The same and more, safe to read from any thread
+    const RenderMetrics &metrics() const { return m_metrics; }
+
+    float videoAngle = 180;
+    bool invert_stereo = false;
+
+    float fieldOfView = DEFAULT_FOV;
+    float rotHor = 0, rotVert = 0;
+
+    // How far ahead of now to predict the head pose, negative means one
+    // refresh interval of the screen we're on (i.e. roughly the scanout time
+    // of the frame we're rendering), 0 disables prediction.
+    float predictionMs = -1;
+
+    // Render the eyes offscreen and warp them to correct for the lenses
+    bool lensCorrection = true;
+
+    // Sample the video straight from the lens corrected display pixels
+    // through a precomputed lookup texture, instead of rendering the eyes
+    // into a buffer and warping that. Saves a full resolution write and read
+    // per eye, but doesn't scale the eyes with the dynamic resolution.
+    bool fusedEyes = false;
+
+    // Pick the viewport per eye in the vertex shader if the driver supports
+    // it, otherwise (or if false) clip each eye to its half of the screen.
+    bool viewportArrayStereo = true;
+
+    // Texels per output pixel at the centre of view, 0 renders the video at
+    // its full resolution
+    float videoScale = 1;
+
+    // Only let mpv render the part of the video that is visible from the
+    // current head pose (plus cropMargin degrees).
+    bool viewportCrop = false;
+    float cropMargin = 20;
+
+    // Let the video resolution exceed GL_MAX_TEXTURE_SIZE and crop to the
+    // tiles in view when it does, even without viewportCrop.
+    bool tiledVideo = true;
+
+    // Trilinear (and anisotropic, if available) filtering of the video,
+    // the video thread builds the mipmaps for every new frame.
+    bool mipmaps = true;
+
+    // Lower the video and eye buffer resolution when the GPU can't keep up
+    // with the refresh rate
+    bool dynamicResolution = true;
+
+    // Show the per section timings in both eyes
+    bool showHud = false;
+
+    // Log the frame counters and prediction error once per second
+    bool logStats = true;
+
+    void updateHud();
+
+    // Shows the image above the centre of both eyes for a moment, e.g. a
+    // seek preview. Needs the context current.
+    void showPreview(const QImage &image);
+
+    // Copy what the headset got into a texture for a mirror window at most
+    // mirrorRate times a second, 0 disables it. Without an eye buffer (no
+    // lens correction, or fused eyes) it is always what the display shows.
+    float mirrorRate = 0;
+    enum MirrorEyes
+    {
+        MirrorBothEyes,
+        MirrorLeftEye,
+        MirrorRightEye
+    } mirrorEyes = MirrorBothEyes;
+    bool mirrorDistorted = false;
+
+    // A copy in a texture shared with the other contexts. The texture name
+    // stays valid until releaseGL().
+    struct MirrorFrame {
+        GLuint texture = 0;
+        QSize size;
+        // The part of the texture with the eyes we mirror
+        QRect rect;
+        GLsync fence = nullptr;
+    };
+    bool hasMirrorFrame() const { return m_mirrorFrame.texture != 0; }
+    // The newest copy since the last call, the caller waits on and deletes
+    // the fence in its own context
+    MirrorFrame takeMirrorFrame();
+
+private:
+    void renderEyes(const VideoFrame &frame);
+    QVector4D eyeUvRect(const VideoFrame &frame, int side) const;
+    QMatrix4x4 eyeProjection() const;
+    float sphereAngle() const;
+    QRectF frameCrop(const QRectF &visible) const;
+    void updateVideoCrop(bool crop);
+    void createEyeUniformBuffer();
+    void updateSphereMesh();
+    void updateDistortionMesh(const DistortionParams &params);
+    void renderDistortion();
+    void updateDistortionLookup(const DistortionParams &params);
+    void renderFused(const VideoFrame &frame);
+    void renderHud();
+    void renderPreview();
+    void renderOverlay(Overlay &overlay, const QRectF &rect);
+    void copyToMirror(GLuint sourceFbo, const QRect &source);
+    void updatePresentationStats(const VideoFrame &frame, qint64 refreshInterval);
+
+    OhmdHandler *m_ohmd;
+    VideoRenderer *m_videoRenderer;
+
+    QSize m_size;
+
+    // The part of m_eyeFbo the eyes are rendered to, both eyes side by side
+    QSize m_eyeBufferSize;
+    GLint m_maxTextureSize = 512;
+
+    QOpenGLShaderProgram *m_sphereShader = nullptr;
+    QOpenGLShaderProgram *m_distortionShader = nullptr;
+    QOpenGLShaderProgram *m_fusedShader = nullptr;
+    ShaderCache m_shaderCache;
+
+    QOpenGLBuffer m_sphereVbo;
+    QOpenGLBuffer m_indexBo;
+    QOpenGLVertexArrayObject m_sphereVao;
+    int m_sphereIndexCount = 0;
+    float m_meshVideoAngle = 0;
+    GLuint m_videoSampler = 0;
+
+    // Per eye matrices and UV rectangles for the single pass stereo draw
+    enum {
+        EyeUniformRegions = 3
+    };
+    GLuint m_eyeUbo = 0;
+    char *m_eyeUniformsMapped = nullptr;
+    GLintptr m_eyeUniformStride = 0;
+    int m_eyeUniformRegion = 0;
+    GLsync m_eyeUniformFences[EyeUniformRegions]{};
+
+    typedef void (QOPENGLF_APIENTRYP ViewportIndexedf)(GLuint index, GLfloat x, GLfloat y, GLfloat w, GLfloat h);
+    ViewportIndexedf m_viewportIndexedf = nullptr;
+
+    // Both eyes side by side, before lens correction
+    QOpenGLFramebufferObject *m_eyeFbo = nullptr;
+    QOpenGLBuffer m_distortionVbo;
+    QOpenGLBuffer m_distortionIndexBo;
+    QOpenGLVertexArrayObject m_distortionVao;
+    int m_distortionIndexCount = 0;
+    DistortionParams m_distortionParams;
+
+    // For the fused eye pass, rebuilt whenever the lenses, the display size
+    // or the field of view change
+    DistortionLookup m_lookup;
+    DistortionParams m_lookupParams;
+    float m_lookupFov = 0;
+    GLuint m_lookupTexture = 0;
+    QOpenGLVertexArrayObject m_fusedVao;
+
+    FrameCounters m_frameCounters;
+    FrameCounters m_lastFrameCounters;
+    RenderMetrics m_metrics;
+    qint64 m_lastRenderTime = 0;
+    QElapsedTimer m_frameCountersTimer;
+
+    // How long each video frame stayed on screen, since the last stats. The
+    // spread of that is the judder.
+    quint64 m_lastFrameSerial = 0;
+    qint64 m_lastFrameTime = 0;
+    double m_frameDurationSum = 0;
+    double m_frameDurationSumSq = 0;
+    int m_frameDurationCount = 0;
+    double m_frameDurationMs = 0;
+    double m_judderMs = 0;
+
+    // What we last asked the video renderer to crop to, the frames tell us
+    // what they actually cover
+    QRectF m_requestedCrop{0.0, 0.0, 1.0, 1.0};
+
+    FrameProfiler m_profiler;
+    TimingRecorder *m_timing = nullptr;
+    quint64 m_frameNumber = 0;
+    Overlay m_hud;
+    Overlay m_preview;
+    QElapsedTimer m_previewTimer;
+
+    ResolutionScaler m_scaler;
+
+    // Alternated, so we never copy into the one the mirror might still be
+    // reading from
+    GLuint m_mirrorTextures[2]{};
+    QSize m_mirrorSizes[2];
+    int m_mirrorIndex = 0;
+    GLuint m_mirrorFbo = 0;
+    MirrorFrame m_mirrorFrame;
+    QElapsedTimer m_mirrorTimer;
+};
+
+#endif // VRRENDERER_H
@@ -1,6 +1,13 @@
 ﻿#include "widget.h"
 
+#include "mpveventpump.h"
 #include "ohmdhandler.h"
+#include "shadercache.h"
+#include "telemetryserver.h"
+#include "startuplog.h"
+#include "thumbnailindex.h"
+#include "videorenderer.h"
+#include "vrrenderer.h"
 
 #include <stdexcept>
 #include <QOpenGLContext>
@@ -14,88 +21,14 @@
 #include <QTime>
 #include <QOpenGLExtraFunctions>
 #include <QKeyEvent>
-#include <cmath>
-
-/********************/
-
-static const QVector3D cube_vertices[] = {
-        // back
-        QVector3D(-1.0f,  1.0f, -1.0f),
-        QVector3D(-1.0f, -1.0f, -1.0f),
-        QVector3D( 1.0f, -1.0f, -1.0f),
-
-        QVector3D( 1.0f, -1.0f, -1.0f),
-        QVector3D( 1.0f,  1.0f, -1.0f),
-        QVector3D(-1.0f,  1.0f, -1.0f),
-
-        // front
-        QVector3D( 1.0f,  1.0f,  1.0f),
-        QVector3D( 1.0f, -1.0f,  1.0f),
-        QVector3D(-1.0f, -1.0f,  1.0f),
-
-        QVector3D(-1.0f, -1.0f,  1.0f),
-        QVector3D(-1.0f,  1.0f,  1.0f),
-        QVector3D( 1.0f,  1.0f,  1.0f),
-
-        // left
-        QVector3D(-1.0f,  1.0f,  1.0f),
-        QVector3D(-1.0f, -1.0f,  1.0f),
-        QVector3D(-1.0f, -1.0f, -1.0f),
-
-        QVector3D(-1.0f, -1.0f, -1.0f),
-        QVector3D(-1.0f,  1.0f, -1.0f),
-        QVector3D(-1.0f,  1.0f,  1.0f),
-
-        // right
-        QVector3D( 1.0f,  1.0f, -1.0f),
-        QVector3D( 1.0f, -1.0f, -1.0f),
-        QVector3D( 1.0f, -1.0f,  1.0f),
-
-        QVector3D( 1.0f, -1.0f,  1.0f),
-        QVector3D( 1.0f,  1.0f,  1.0f),
-        QVector3D( 1.0f,  1.0f, -1.0f),
-
-        // top
-        QVector3D(-1.0f,  1.0f, -1.0f),
-        QVector3D( 1.0f,  1.0f, -1.0f),
-        QVector3D( 1.0f,  1.0f,  1.0f),
-
-        QVector3D( 1.0f,  1.0f,  1.0f),
-        QVector3D(-1.0f,  1.0f,  1.0f),
-        QVector3D(-1.0f,  1.0f, -1.0f),
-
-        // bottom
-        QVector3D( 1.0f, -1.0f, -1.0f),
-        QVector3D(-1.0f, -1.0f, -1.0f),
-        QVector3D(-1.0f, -1.0f,  1.0f),
-
-        QVector3D(-1.0f, -1.0f,  1.0f),
-        QVector3D( 1.0f, -1.0f,  1.0f),
-        QVector3D( 1.0f, -1.0f, -1.0f)
-    };
-
-/***************************************/
-static void wakeup(void *ctx)
-{
-    QMetaObject::invokeMethod((MpvWidget*)ctx, &MpvWidget::on_mpv_events, Qt::QueuedConnection);
-}
-
-static void *get_proc_address(void *ctx, const char *name) {
-    Q_UNUSED(ctx);
-    QOpenGLContext *glctx = QOpenGLContext::currentContext();
-    if (!glctx)
-        return nullptr;
-    return reinterpret_cast<void *>(glctx->getProcAddress(QByteArray(name)));
-}
+#include <cstring>
 
-MpvWidget::MpvWidget() :
-    m_indexBo(QOpenGLBuffer::IndexBuffer)
-    //m_cubeVbo(QOpenGLBuffer::VertexBuffer)
+MpvWidget::MpvWidget() : QOpenGLWindow(QOpenGLContext::globalShareContext())
 {
     setFlag(Qt::Dialog);
 
-    video_projection_mode = SideBySide;
-    invert_stereo = false;
+    // Starts probing the headset on the pose thread, while we set up mpv
+    m_ohmd = new OhmdHandler(this);
 
     setlocale(LC_NUMERIC, "C");
     m_mpv = mpv_create();
@@ -117,19 +50,48 @@ MpvWidget::MpvWidget() :
     const QString watchLaterDir = QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation) + "/mpv/watch_later/";
     mpv_set_option_string(m_mpv, "watch-later-directory", watchLaterDir.toUtf8().constData());
 
-    //mpv::qt::set_option_variant(m_mpv, "hwdec", "auto");
+    // mpv compiles its whole scaling and color pipeline on the first frame,
+    // keep its binaries next to ours
+    mpv_set_option_string(m_mpv, "gpu-shader-cache-dir", ShaderCache::directory().toUtf8().constData());
+    StartupLog::mark("mpv initialized");
 
-    mpv_observe_property(m_mpv, 0, "duration", MPV_FORMAT_DOUBLE);
-    mpv_observe_property(m_mpv, 0, "playback-time", MPV_FORMAT_DOUBLE);
-    mpv_observe_property(m_mpv, 0, "width", MPV_FORMAT_INT64);
-    mpv_observe_property(m_mpv, 0, "height", MPV_FORMAT_INT64);
-    mpv_set_wakeup_callback(m_mpv, wakeup, this);
+    //mpv::qt::set_option_variant(m_mpv, "hwdec", "auto");
 
-    m_updateFboTimer.setSingleShot(true);
-    m_updateFboTimer.setInterval(10);
-    connect(&m_updateFboTimer, &QTimer::timeout, this, &MpvWidget::resizeFbo);
+    // The events are handled off the GUI thread, paintGL() picks up the
+    // video size from the newest snapshot
+    m_events = new MpvEventPump(m_mpv, this);
+    connect(m_events, &MpvEventPump::videoSizeChanged, this, [this]() { update(); });
+    connect(m_events, &MpvEventPump::durationChanged, this, &MpvWidget::durationChanged);
+    connect(m_events, &MpvEventPump::positionChanged, this, &MpvWidget::positionChanged);
+    m_events->startPump();
+
+    m_thumbnails = new ThumbnailIndex(this);
+    connect(m_events, &MpvEventPump::pathChanged, this, [this](const QByteArray &path) {
+        if (seekPreviews && !path.isEmpty()) {
+            m_thumbnails->index(path);
+        }
+    });
+
+    // mpv renders on its own thread and context, we just composite whatever
+    // frame it finished last.
+    m_videoRenderer = new VideoRenderer(m_mpv, this);
+    connect(m_videoRenderer, &VideoRenderer::ready, this, &MpvWidget::onVideoRendererReady);
+
+    m_renderer = new VrRenderer(m_ohmd, m_videoRenderer);
+    connect(this, &QOpenGLWindow::frameSwapped, this, [this]() {
+        m_renderer->endSwap();
+        m_videoRenderer->reportSwap();
+        if (m_firstFrameRendered) {
+            m_firstFrameRendered = false;
+            StartupLog::finish("first video frame presented");
+        }
+    });
 
-    m_ohmd = new OhmdHandler(this);
+    // mpv won't open the video output without a render context, so create
+    // it right away instead of waiting for the window to be exposed. It
+    // only needs the global share context, and renders nothing until
+    // initializeGL() gives it a size.
+    m_videoRenderer->startRendering();
 
     connect(qGuiApp, &QGuiApplication::screenAdded, this, &MpvWidget::onScreenAdded);
 
@@ -139,22 +101,64 @@ MpvWidget::MpvWidget() :
 MpvWidget::~MpvWidget()
 {
     makeCurrent();
-    if (m_mpvGl)
-        mpv_render_context_free(m_mpvGl);
+    m_renderer->releaseGL();
+    doneCurrent();
+
+    // The render context has to be gone before the mpv handle
+    m_videoRenderer->stopRendering();
+    m_events->stopPump();
+    if (m_telemetry) {
+        m_telemetry->stopServing();
+    }
     mpv_terminate_destroy(m_mpv);
+
+    delete m_renderer;
+}
+
+void MpvWidget::play(const QByteArrayList &paths)
+{
+    m_paths = paths;
+
+    // Otherwise onVideoRendererReady() loads it
+    if (m_videoRenderer->isReady()) {
+        loadPlaylist();
+    }
+}
+
+void MpvWidget::startTelemetry(const QString &socketPath)
+{
+    if (m_telemetry) {
+        return;
+    }
+    m_telemetry = new TelemetryServer(socketPath, &m_renderer->metrics(), m_mpv, this);
+    m_telemetry->startServing();
 }
 
-void MpvWidget::play(const char *path)
+void MpvWidget::onVideoRendererReady()
 {
-    m_path = path;
+    if (!m_paths.isEmpty()) {
+        loadPlaylist();
+    }
+}
+
+void MpvWidget::loadPlaylist()
+{
+    if (m_paths.size() > 1 && prefetch) {
+        // Open the next entry and fill the cache for it while the current
+        // one is still playing, also for local files
+        mpv_set_property_string(m_mpv, "prefetch-playlist", "yes");
+        mpv_set_property_string(m_mpv, "cache", "yes");
+    }
+    if (loopPlaylist) {
+        mpv_set_property_string(m_mpv, "loop-playlist", "inf");
+    }
 
-    if (m_mpvGl) {
-        const char *args[] = {"loadfile", path, NULL};
+    for (int i = 0; i < m_paths.size(); i++) {
+        const char *args[] = {"loadfile", m_paths[i].constData(), i == 0 ? "replace" : "append", NULL};
         mpv_command(m_mpv, args);
-        m_path = nullptr;
-    } else {
-        qWarning() << "init gl not done yet";
     }
+    m_paths.clear();
+    StartupLog::mark("loadfile");
 }
 
 /*
@@ -177,112 +181,72 @@ void GLAPIENTRY s_messageCallback(GLenum source, GLenum type, GLuint id, GLenum
 
 void MpvWidget::initializeGL()
 {
-    glEnable (GL_DEBUG_OUTPUT);
-    QOpenGLExtraFunctions(context()).glDebugMessageCallback(s_messageCallback, 0);
+    StartupLog::mark("window context created");
+    initializeOpenGLFunctions();
 
-    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &m_maxTextureSize);
+    glEnable (GL_DEBUG_OUTPUT);
+    glDebugMessageCallback(s_messageCallback, 0);
 
     for (const QScreen *screen : qApp->screens()) {
         qDebug() << "during init" << screen->refreshRate() << screen->size();
     }
-    /* Sphere shader */
-    m_sphereShader = new QOpenGLShaderProgram(this);
-    m_sphereShader->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/shader/sphere.vert");
-    const char *fragsource =
-           "#version 330\n"
-            "uniform sampler2D warpTexture;\n"
-            "in vec2 T;\n"
-           "out vec4 color;\n"
-           "void main(void)\n"
-           "{\n"
-           "    color = vec4(1.0, 1.0, 0.0, 1.0);\n"
-           "}\n";
-    //m_sphereShader->addShaderFromSourceCode(QOpenGLShader::Fragment, fragsource);
-    m_sphereShader->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/shader/sphere.frag");
-    m_sphereShader->link();
-
-    m_sphereShader->bind();
-    m_sphereShader->setUniformValue("tex_uni", 0);
-
-    m_sphereShader->bindAttributeLocation("vertex_attr", 0);
-
-    m_cubeVao.create();
-    m_cubeVao.bind();
-
-    m_cubeVbo.create();
-    m_cubeVbo.bind();
-    m_cubeVbo.setUsagePattern(QOpenGLBuffer::StaticDraw);
-
-    const quint32 slices = 50;
-    const quint32 stacks = 50;
-    nIndices = slices * stacks;
-
-    m_cubeVbo.allocate(cube_vertices, sizeof(cube_vertices));
-    nIndices = sizeof(cube_vertices)/sizeof(cube_vertices[0]);
-    qDebug() << "indices" << nIndices << sizeof(cube_vertices) << sizeof(cube_vertices[0]);
-    //m_cubeVbo.release();
-
-    m_sphereShader->enableAttributeArray(0);
-    m_sphereShader->setAttributeBuffer(0, GL_FLOAT, 0, 3);
-
-    m_sphereShader->release();
-    m_cubeVbo.release();
-    //m_indexBo.release();
-    m_cubeVao.release();
-
-
-
-    m_videoFbo = new QOpenGLFramebufferObject(size());
-    m_videoFbo->bind();
-
-    mpv_opengl_init_params gl_init_params{get_proc_address, nullptr, nullptr};
-    mpv_render_param params[]{
-        {MPV_RENDER_PARAM_API_TYPE, const_cast<char *>(MPV_RENDER_API_TYPE_OPENGL)},
-        {MPV_RENDER_PARAM_OPENGL_INIT_PARAMS, &gl_init_params},
-        {MPV_RENDER_PARAM_INVALID, nullptr}
-    };
-
-    if (mpv_render_context_create(&m_mpvGl, m_mpv, params) < 0)
-        throw std::runtime_error("failed to initialize mpv GL context");
-    mpv_render_context_set_update_callback(m_mpvGl, MpvWidget::on_update, reinterpret_cast<void *>(this));
-
-    if (m_path) {
-        const char *args[] = {"loadfile", m_path, NULL};
-        mpv_command(m_mpv, args);
-        m_path = nullptr;
-    }
-}
 
-void MpvWidget::paintGL()
-{
-    if (!m_videoFbo) {
-        return;
+    m_renderer->initializeGL();
+    StartupLog::mark("renderer initialized");
+    if (!timingCsvPath.isEmpty()) {
+        m_renderer->profiler().openCsv(timingCsvPath);
     }
 
-    mpv_opengl_fbo mpfbo{static_cast<int>(m_videoFbo->handle()), m_videoFbo->width(), m_videoFbo->height(), GL_RGBA8};
-    int flip_y{0};
+    // Render something until we know the video size
+    m_videoRenderer->setVideoSize(size());
 
-    mpv_render_param params[] = {
-        {MPV_RENDER_PARAM_OPENGL_FBO, &mpfbo},
-        {MPV_RENDER_PARAM_FLIP_Y, &flip_y},
-        {MPV_RENDER_PARAM_INVALID, nullptr}
-    };
-    mpv_render_context_render(m_mpvGl, params);
+    if (m_renderer->viewportCrop || m_renderer->tiledVideo) {
+        // Stretch the video to whatever we render it to, we take care of
+        // the aspect ratio when mapping it onto the sphere.
+        mpv_set_property_string(m_mpv, "keepaspect", "no");
+    }
 
+    if (timewarp) {
+        // Keep repainting at the display rate, paintGL() figures out if it
+        // has a new video frame or just needs to reproject the old one.
+        connect(this, &QOpenGLWindow::frameSwapped, this, [this]() { update(); });
 
-    m_ohmd->update();
+        if (displaySync) {
+            mpv_set_property_string(m_mpv, "video-sync", "display-resample");
+            m_videoRenderer->setDisplaySync(true);
+        }
+    } else {
+        connect(m_videoRenderer, &VideoRenderer::frameRendered, this, &MpvWidget::maybeUpdate);
+    }
+}
 
-    makeCurrent();
-    glClear(GL_COLOR_BUFFER_BIT);
-    //glEnable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    //glDisable(GL_BLEND);
-    //glDepthMask(GL_FALSE);
+void MpvWidget::paintGL()
+{
+    m_events->update();
+
+    const qreal refreshRate = screen() ? screen()->refreshRate() : 60.;
+    if (!qFuzzyCompare(refreshRate, m_displayRate)) {
+        setDisplayRate(refreshRate);
+    }
+    m_renderer->render(defaultFramebufferObject(), size(), 1000000000 / qMax(refreshRate, 1.));
+
+    // The first fresh frame after mpv knows the video size is the first
+    // video frame, anything before is just the empty player
+    if (!m_startupDone) {
+        const quint64 fresh = m_renderer->frameCounters().fresh;
+        if (m_events->state().videoSize.isEmpty()) {
+            m_framesBeforeVideo = fresh;
+        } else if (fresh > m_framesBeforeVideo) {
+            m_firstFrameRendered = true;
+            m_startupDone = true;
+        }
+    }
 
-    renderEye(0, m_ohmd->modelView[0], m_ohmd->projection[0]);
-    renderEye(1, m_ohmd->modelView[1], m_ohmd->projection[1]);
+    // The field of view or the window might have changed
+    resizeFbo();
 
-    makeCurrent();
+    // Ends when Qt emits frameSwapped
+    m_renderer->beginSwap();
 
 //    if (!m_posImage.isNull()) {
 //        QPainter p(this);
@@ -303,84 +267,22 @@ void MpvWidget::paintGL()
     //    }
 }
 
-void MpvWidget::showEvent(QShowEvent *e)
+void MpvWidget::setDisplayRate(qreal refreshRate)
 {
-    qWarning() << "===============" << e;
-}
+    m_displayRate = refreshRate;
+    m_videoRenderer->setDisplayInterval(1000000000 / qMax(refreshRate, 1.));
 
-void MpvWidget::on_mpv_events()
-{
-    // Process all events, until the event queue is empty.
-    while (m_mpv) {
-        mpv_event *event = mpv_wait_event(m_mpv, 0);
-        if (event->event_id == MPV_EVENT_NONE) {
-            break;
-        }
-        handle_mpv_event(event);
+    // mpv can't ask the display itself with the render API. Renamed in 0.37.
+    const QByteArray fps = QByteArray::number(refreshRate, 'f', 3);
+    if (mpv_set_property_string(m_mpv, "display-fps-override", fps.constData()) < 0) {
+        mpv_set_property_string(m_mpv, "override-display-fps", fps.constData());
     }
+    qDebug() << "presenting at" << refreshRate << "Hz";
 }
 
-void MpvWidget::handle_mpv_event(mpv_event *event)
+void MpvWidget::showEvent(QShowEvent *e)
 {
-    switch (event->event_id) {
-    case MPV_EVENT_PROPERTY_CHANGE: {
-        mpv_event_property *prop = (mpv_event_property *)event->data;
-        if (strcmp(prop->name, "playback-time") == 0) {
-            if (prop->format == MPV_FORMAT_DOUBLE) {
-                int time = (*(double *)prop->data) * 1000;
-                if (time == m_position) {
-                    return;
-                }
-                m_position = time;
-                Q_EMIT positionChanged(time);
-            }
-        } else if (strcmp(prop->name, "duration") == 0) {
-            if (prop->format == MPV_FORMAT_DOUBLE) {
-                int time = (*(double *)prop->data) * 1000.;
-                if (time == m_duration) {
-                    return;
-                }
-                m_duration = time;
-                Q_EMIT durationChanged(time);
-            }
-        } else if (strcmp(prop->name, "width") == 0) {
-            if (prop->format != MPV_FORMAT_INT64) {
-                return;
-            }
-            m_videoWidth = (*(int64_t *)prop->data);
-            m_updateFboTimer.start();
-        } else if (strcmp(prop->name, "height") == 0) {
-            if (prop->format != MPV_FORMAT_INT64) {
-                return;
-            }
-            m_videoHeight = (*(int64_t *)prop->data);
-            m_updateFboTimer.start();
-        } else {
-            return;
-        }
-        break;
-    }
-    default: ;
-        return;
-    }
-//    QString posString = QTime::fromMSecsSinceStartOfDay(m_position).toString() + "/" + QTime::fromMSecsSinceStartOfDay(m_duration).toString();
-//    QPainterPath posPath;
-
-//    QFont font = qApp->font();
-//    font.setPointSize(20);
-//    font.setBold(true);
-//    posPath.addText(10, QFontMetrics(font).ascent(), font, posString);
-
-//    QPainterPathStroker stroker;
-//    stroker.setWidth(2);
-//    QPainterPath posPathOutline = stroker.createStroke(posPath);
-//    const QRect outlineRect = posPathOutline.boundingRect().toAlignedRect();
-//    m_posImage = QImage(outlineRect.right(), outlineRect.bottom(), QImage::Format_ARGB32_Premultiplied);
-//    m_posImage.fill(Qt::transparent);
-//    QPainter p(&m_posImage);
-//    p.setPen(QPen(QColor(0, 0, 0, 32), 2));
-//    p.setBrush(QColor(255, 255, 255, 64));
-//    p.drawPath(posPath);
+    qWarning() << "===============" << e;
 }
 
 // Make Qt invoke mpv_opengl_cb_draw() to draw a new/updated video frame.
@@ -406,6 +308,7 @@ void MpvWidget::maybeUpdate()
 void MpvWidget::onScreenAdded()
 {
     // quick hack to try to position into the correct display
+    m_ohmd->waitForInit();
     if (m_ohmd->displaySize.isEmpty()) {
         qWarning() << "Display size not fetched!";
         return;
@@ -431,178 +334,60 @@ void MpvWidget::onScreenAdded()
 
 }
 
-void MpvWidget::renderEye(int eye, const QMatrix4x4 &modelview, QMatrix4x4 projectionl)
-{
-    int w = width();
-    int h = height();
-
-    int eye_inv = invert_stereo ? 1 - eye : eye;
-
-    if (eye_inv == 1) {
-        glViewport(w/2, 0, w/2, h);
-    } else {
-        glViewport(0, 0, w/2, h);
-    }
-
-    m_sphereShader->bind();
-
-    QMatrix4x4 projection;
-    projection.perspective(m_fieldOfView, ((float)(w/2)) / (float)h, 0.1f, 1000.0f);
-    projection.rotate(m_rotHor, QVector3D(0, 1, 0));
-    projection.rotate(m_rotVert, QVector3D(1, 0, 0));
-    //projection.translate(0, 0, -1);
-//    qDebug() << "==========" << eye << "=============";
-//    qDebug() << projection;
-//    qDebug() << projectionl;
-//    qDebug() << projectionl.inverted();
-
-    m_sphereShader->setUniformValue("modelview_projection_uni", projection * modelview);
-
-//    m_sphereShader->setUniformValue("mvp", projection * modelview);
-//    m_sphereShader->setUniformValue("WarpScale", m_ohmd->warp_scale * m_ohmd->warp_adj);
-//    m_sphereShader->setUniformValueArray("HmdWarpParam", m_ohmd->distortion_coeffs, 4, 1);
-//    m_sphereShader->setUniformValueArray("LensCenter", eye == 0 ? m_ohmd->left_lens_center : m_ohmd->right_lens_center, 2, 1);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, m_videoFbo->texture());
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-
-    switch(video_projection_mode)
-    {
-        case Monoscopic:
-            m_sphereShader->setUniformValue("min_max_uv_uni", 0.0f, 0.0f, 1.0f, 1.0f);
-            break;
-        case OverUnder:
-            if(eye_inv == 1)
-                m_sphereShader->setUniformValue("min_max_uv_uni", 0.0f, 0.5f, 1.0f, 1.0f);
-            else
-                m_sphereShader->setUniformValue("min_max_uv_uni", 0.0f, 0.0f, 1.0f, 0.5f);
-            break;
-        case SideBySide:
-            if(eye_inv == 1) {
-                m_sphereShader->setUniformValue("min_max_uv_uni",
-                        0.5f, 0.0f,
-                        1.0f, 1.0f);
-            } else {
-                m_sphereShader->setUniformValue("min_max_uv_uni",
-                        0.0f, 0.0f,
-                        0.5f, 1.0f);
-            }
-            break;
-    }
-    if (eye == 0) {
-        m_sphereShader->setUniformValue("eye_offset", 0.f);//-m_ohmd->horiz_sep);
-    } else {
-        m_sphereShader->setUniformValue("eye_offset", 0.f);//m_ohmd->horiz_sep);
-    }
-
-    m_sphereShader->setUniformValue("projection_angle_factor_uni", 360.0f / float(videoAngle));
-
-    //glBegin(GL_QUADS);
-    //glTexCoord2d( 0,  0);
-    //glVertex3d(  -1, -1, 0);
-    //glTexCoord2d( 1,  0);
-    //glVertex3d(   0, -1, 0);
-    //glTexCoord2d( 1,  1);
-    //glVertex3d(   0,  1, 0);
-    //glTexCoord2d( 0,  1);
-    //glVertex3d(  -1,  1, 0);
-    //glEnd();
-
-        //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereVbo[2]);
-        //glDrawElements(GL_TRIANGLE_STRIP, nIndices, GL_UNSIGNED_SHORT, nullptr);
-        //glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    m_cubeVao.bind();
-    glDrawArrays(GL_TRIANGLES, 0, 6 * 6);
-    m_cubeVao.release();
-
-    //m_indexBo.release();
-
-    //QOpenGLFunctions *f = context()->functions();
-
-    //qDebug() << "getting";
-    //int vertexattr = m_sphereShader->attributeLocation("vertex_attr");
-    //qDebug() << vertexattr;
-    ////m_sphereShader->enableAttributeArray(vertexattr);
-    //m_cubeVbo.bind();
-    //qDebug() << "bound";
-    //f->glEnableVertexAttribArray(vertexattr);
-    //f->glVertexAttribPointer(vertexattr, 3, GL_FLOAT, 0, 0, 0);
-    ////m_sphereShader->setAttributeBuffer(vertexattr, GL_FLOAT, 0, 3);
-    //qDebug() << "drawing";
-    //glDrawArrays(GL_TRIANGLE_FAN, 0, nIndices);
-    //qDebug() << "releasing";
-    //m_cubeVbo.release();
-
-    m_sphereShader->release();
-
-}
-
-void MpvWidget::on_update(void *ctx)
-{
-    QMetaObject::invokeMethod((MpvWidget*)ctx, "maybeUpdate");
-}
-
 void MpvWidget::resizeFbo()
 {
-    if (m_videoWidth <= 0 || m_videoHeight <= 0) {
+    const QSize sourceSize = m_events->state().videoSize;
+    if (sourceSize.isEmpty()) {
         return;
     }
-    QSize videoSize(m_videoWidth, m_videoHeight);
-    qDebug() << m_maxTextureSize;
-    if (m_videoWidth > m_maxTextureSize || m_videoHeight > m_maxTextureSize) {
-        QSize maxSize(m_maxTextureSize, m_maxTextureSize);
-        videoSize = videoSize.scaled(maxSize, Qt::KeepAspectRatio);
-    }
-    if (m_videoFbo->size() == videoSize) {
+    const QSize videoSize = m_renderer->videoTextureSize(sourceSize, size());
+    if (videoSize == m_videoTextureSize) {
         return;
     }
-    qDebug() << "new size" << videoSize;
-    delete m_videoFbo;
-    m_videoFbo = new QOpenGLFramebufferObject(videoSize);
+    const QSize textureSize = videoSize.boundedTo(QSize(m_renderer->maxTextureSize(), m_renderer->maxTextureSize()));
+    qDebug() << "new size" << videoSize << "for" << sourceSize << "video,"
+             << (textureSize.width() * textureSize.height() * 4 / 1024 / 1024) << "MB per frame";
+    m_videoTextureSize = videoSize;
+    m_videoRenderer->setVideoSize(videoSize);
 }
 
 void MpvWidget::keyPressEvent(QKeyEvent *event)
 {
     if (event->key() == Qt::Key_Plus || event->key() == Qt::Key_Equal) {
-        m_fieldOfView-= 10;
-        if (m_fieldOfView < 45) {
-            m_fieldOfView = 45;
+        m_renderer->fieldOfView -= 10;
+        if (m_renderer->fieldOfView < 45) {
+            m_renderer->fieldOfView = 45;
         }
         return;
     }
     if (event->key() == Qt::Key_Minus) {
-        m_fieldOfView += 10;
-        if (m_fieldOfView > 150) {
-            m_fieldOfView = 150;
+        m_renderer->fieldOfView += 10;
+        if (m_renderer->fieldOfView > 150) {
+            m_renderer->fieldOfView = 150;
         }
         return;
     }
     if (event->key() == Qt::Key_Escape) {
-        m_rotVert = 0;
-        m_rotHor = 0;
-        m_fieldOfView = DEFAULT_FOV;
+        m_renderer->rotVert = 0;
+        m_renderer->rotHor = 0;
+        m_renderer->fieldOfView = DEFAULT_FOV;
         return;
     }
 
     if (event->key() == Qt::Key_W) {
-        m_rotVert--;
+        m_renderer->rotVert--;
         return;
     }
     if (event->key() == Qt::Key_S) {
-        m_rotVert++;
+        m_renderer->rotVert++;
         return;
     }
     if (event->key() == Qt::Key_A) {
-        m_rotHor--;
+        m_renderer->rotHor--;
         return;
     }
     if (event->key() == Qt::Key_D) {
-        m_rotHor++;
+        m_renderer->rotHor++;
         return;
     }
 
@@ -611,6 +396,15 @@ void MpvWidget::keyPressEvent(QKeyEvent *event)
         return;
     }
 
+    if (event->key() == Qt::Key_H) {
+        m_renderer->showHud = !m_renderer->showHud;
+        if (m_renderer->showHud) {
+            makeCurrent();
+            m_renderer->updateHud();
+        }
+        return;
+    }
+
     if (event->key() == Qt::Key_Shift ||
             event->key() == Qt::Key_Control ||
             event->key() == Qt::Key_Meta ||
@@ -641,6 +435,30 @@ void MpvWidget::keyPressEvent(QKeyEvent *event)
         keyString.chop(1);
     }
 
+    // Where mpv's default bindings will seek to
+    double seek = 0;
+    switch (event->key()) {
+    case Qt::Key_Left:
+        seek = -5;
+        break;
+    case Qt::Key_Right:
+        seek = 5;
+        break;
+    case Qt::Key_Down:
+        seek = -60;
+        break;
+    case Qt::Key_Up:
+        seek = 60;
+        break;
+    }
+    if (seek != 0) {
+        const QImage preview = m_thumbnails->thumbnail(m_events->state().position + seek);
+        if (!preview.isNull()) {
+            makeCurrent();
+            m_renderer->showPreview(preview);
+        }
+    }
+
     const char *args[] = {"keypress", keyString.constData(), NULL};
     mpv_command(m_mpv, args);
 //    switch(event->key()) {
@@ -5,38 +5,54 @@
 #include <mpv/client.h>
 #include <mpv/render_gl.h>
 #include "mpv-qthelper.hpp"
-#include <QOpenGLFunctions>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLVertexArrayObject>
-#include <QOpenGLBuffer>
-#include <QOpenGLFramebufferObject>
+#include <QOpenGLExtraFunctions>
 #include <QTimer>
 
+class MpvEventPump;
 class OhmdHandler;
+class TelemetryServer;
+class ThumbnailIndex;
+class VideoRenderer;
+class VrRenderer;
 
-#define DEFAULT_FOV 80
-
-class MpvWidget Q_DECL_FINAL: public QOpenGLWindow //, protected QOpenGLFunctions
+class MpvWidget Q_DECL_FINAL: public QOpenGLWindow, protected QOpenGLExtraFunctions
 {
     Q_OBJECT
 public:
-    enum VideoProjectionMode
-    {
-        Monoscopic,
-        OverUnder,
-        SideBySide
-    } video_projection_mode = SideBySide;
-
     MpvWidget();
     ~MpvWidget();
     QSize sizeHint() const { return QSize(480, 270);}
 
-    void play(const char *path);
+    // Plays the files one after the other
+    void play(const QByteArrayList &paths);
+
+    // Serves the playback and rendering metrics on a Unix domain socket
+    void startTelemetry(const QString &socketPath);
+
+    OhmdHandler *ohmd() const { return m_ohmd; }
+    VrRenderer *renderer() const { return m_renderer; }
+
+    // Re-render both eyes at display rate with the freshest head pose, even
+    // when mpv doesn't have a new video frame for us.
+    bool timewarp = true;
+
+    // Write every timing sample to this file if set
+    QString timingCsvPath;
 
-    float videoAngle = 180;
+    // Start over at the end of the playlist
+    bool loopPlaylist = false;
 
-public slots:
-    void on_mpv_events();
+    // Let mpv open and buffer the next playlist entry while the current one
+    // plays
+    bool prefetch = true;
+
+    // Index thumbnails in the background and show them when seeking
+    bool seekPreviews = true;
+
+    // Let mpv time the video to the headset's refresh rate, resampling the
+    // audio to match (video-sync=display-resample). Needs timewarp, mpv is
+    // paced by our buffer swaps.
+    bool displaySync = true;
 
 Q_SIGNALS:
     void durationChanged(int value);
@@ -51,49 +67,37 @@ private Q_SLOTS:
     void maybeUpdate();
     void onScreenAdded();
     void resizeFbo();
+    void onVideoRendererReady();
 
 private:
-    void renderEye(int eye, const QMatrix4x4 &modelview, QMatrix4x4 projection);
-    void handle_mpv_event(mpv_event *event);
-    static void on_update(void *ctx);
+    void loadPlaylist();
+    void setDisplayRate(qreal refreshRate);
 
     mpv_handle *m_mpv = nullptr;
-    mpv_render_context *m_mpvGl = nullptr;
+    MpvEventPump *m_events = nullptr;
+    ThumbnailIndex *m_thumbnails = nullptr;
+    TelemetryServer *m_telemetry = nullptr;
+    VideoRenderer *m_videoRenderer = nullptr;
     OhmdHandler *m_ohmd;
+    VrRenderer *m_renderer = nullptr;
 
-    bool invert_stereo = true;
-
-    float m_fieldOfView = DEFAULT_FOV;
-    float m_distance = 100.f;
-    double m_duration = 0;
-    double m_position = 0;
-
-    float m_rotHor = 0, m_rotVert = 0;
-
-    QOpenGLShaderProgram *m_sphereShader = nullptr;
-    QOpenGLShaderProgram *m_distortionShader = nullptr;
-
-    QOpenGLBuffer m_cubeVbo;
-    QOpenGLBuffer m_indexBo;
-    QOpenGLVertexArrayObject m_cubeVao;
-    QOpenGLFramebufferObject *m_videoFbo = nullptr;
-    const char *m_path = nullptr;
+    QByteArrayList m_paths;
 
     QImage m_posImage;
 
+    QSize m_videoTextureSize;
+    qreal m_displayRate = 0;
 
-    QTimer m_updateFboTimer;
-    int m_videoWidth = 0;
-    int m_videoHeight = 0;
-    GLint m_maxTextureSize = 512;
+    // Startup is logged until the first video frame is swapped in
+    quint64 m_framesBeforeVideo = 0;
+    bool m_firstFrameRendered = false;
+    bool m_startupDone = false;
 
     //QPainterPath m_posString;
     //QPainterPath m_posStringStroke;
 
 protected:
     void keyPressEvent(QKeyEvent *event) override;
-    quint32 sphereVbo[3];
-    quint32 nIndices;
 };
 
 